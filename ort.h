@@ -1,24 +1,151 @@
 #pragma once
 
 #include "imports.h"
+#include "ort_ffi_trace.h"
 #include <type_traits>
 #include <stdexcept>
 #include <functional>
 #include <vector>
 #include <memory>
 #include <string>
-#include <iostream>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <initializer_list>
+#include <chrono>
+#include <charconv>
+#include <limits>
+#ifdef HX_ORT_ENABLE_PROFILER
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define HX_ORT_HAS_COROUTINES 1
+#endif
 
 namespace hexagon {
 
 void EnableDebug() {
-    hexagon_enable_debug();
+    HX_ORT_FFI(hexagon_enable_debug)();
 }
 
 namespace ort {
 
+// Result of the noexcept callback paths (ProxiedObject::TryCall/TryGetField).
+enum class Status {
+    Ok,
+    NotFound,
+    Error
+};
+
+// Preallocated per-thread storage for the message of the last error a
+// native callback reported to the backend. Writing it never allocates;
+// long messages are truncated.
+class ErrorSlot {
+private:
+    char message[256];
+    size_t len = 0;
+
+    void append(const char *s) noexcept {
+        while(*s && len < sizeof(message) - 1) {
+            message[len++] = *s++;
+        }
+        message[len] = 0;
+    }
+
+public:
+    ErrorSlot() noexcept {
+        message[0] = 0;
+    }
+
+    void Set(const char *msg) noexcept {
+        len = 0;
+        append(msg);
+    }
+
+    void Set(const char *prefix, const char *detail) noexcept {
+        len = 0;
+        append(prefix);
+        append(detail);
+    }
+
+    const char * Message() const noexcept {
+        return message;
+    }
+
+    void Clear() noexcept {
+        len = 0;
+        message[0] = 0;
+    }
+
+    static ErrorSlot& Current() noexcept {
+        static thread_local ErrorSlot slot;
+        return slot;
+    }
+};
+
+// Message of the last error a native callback on this thread reported.
+inline const char * LastNativeError() noexcept {
+    return ErrorSlot::Current().Message();
+}
+
+namespace detail {
+    // Bumped whenever a native callback (LoadNative function or proxy
+    // method) swallows an error on this thread. Lets callers attribute
+    // failures to a particular Invoke without a backend error channel.
+    inline unsigned long long& native_error_count() {
+        static thread_local unsigned long long count = 0;
+        return count;
+    }
+
+    inline void report_native_error(const char *msg) noexcept {
+        native_error_count()++;
+        ErrorSlot::Current().Set(msg);
+    }
+
+    // For catch blocks: records the in-flight exception's message.
+    inline void report_current_exception() noexcept {
+        try {
+            throw;
+        } catch(const std::exception& e) {
+            report_native_error(e.what());
+        } catch(...) {
+            report_native_error("Unknown exception");
+        }
+    }
+
+    // Runs `f`, turning any exception into Status::Error with its message
+    // in ErrorSlot::Current(). `unknown` is the message for exceptions not
+    // derived from std::exception.
+    template<class F>
+    inline Status capture_status(const char *unknown, F&& f) noexcept {
+        try {
+            f();
+            return Status::Ok;
+        } catch(const std::exception& e) {
+            ErrorSlot::Current().Set(e.what());
+            return Status::Error;
+        } catch(...) {
+            ErrorSlot::Current().Set(unknown);
+            return Status::Error;
+        }
+    }
+} // namespace detail
+
 class Runtime;
 class ObjectHandle;
+class BorrowedObjectHandle;
 
 enum class ValueType {
     Unknown,
@@ -29,6 +156,79 @@ enum class ValueType {
     Object
 };
 
+// Type tag and scalar payload of a Value, as returned by Value::Decode.
+// Only the member matching `type` is meaningful.
+struct DecodedValue {
+    ValueType type;
+    union {
+        long long i64;
+        double f64;
+        bool b;
+    };
+};
+
+// Owner of a NUL-terminated copy the backend made of one of its strings,
+// freed with hexagon_glue_destroy_cstring. This is not a borrowed view:
+// the backend still allocates and copies on every read. What it saves
+// over ToString is the second copy into a std::string. It stays valid
+// for its own lifetime regardless of what happens to the Value. Strings
+// with embedded NULs are cut at the first one, as the C ABI has no length.
+class OwnedCString {
+private:
+    char *data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    OwnedCString() = default;
+
+    // Takes ownership of a string returned by the backend.
+    explicit OwnedCString(char *backend_str) noexcept : data_(backend_str) {
+        if(data_) {
+            size_ = strlen(data_);
+        }
+    }
+
+    OwnedCString(const OwnedCString& other) = delete;
+
+    OwnedCString(OwnedCString&& other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    OwnedCString& operator=(OwnedCString&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~OwnedCString() {
+        if(data_) {
+            HX_ORT_FFI(hexagon_glue_destroy_cstring)(data_);
+        }
+    }
+
+    const char * data() const noexcept {
+        return data_ ? data_ : "";
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    std::string_view View() const noexcept {
+        return std::string_view(data(), size_);
+    }
+
+    // False if the backend returned no string.
+    explicit operator bool() const noexcept {
+        return data_ != nullptr;
+    }
+
+    operator std::string_view() const noexcept {
+        return View();
+    }
+};
+
 class Value {
 private:
     HxOrtValue res;
@@ -38,7 +238,7 @@ public:
     }
 
     ValueType Type() const noexcept {
-        char t = hexagon_ort_value_get_type(&res);
+        char t = HX_ORT_FFI(hexagon_ort_value_get_type)(&res);
         switch(t) {
             case 'B': {
                 return ValueType::Bool;
@@ -65,9 +265,14 @@ public:
         return res;
     }
 
+    // Views an array of Values as the HxOrtValue array the backend expects.
+    static const HxOrtValue * RawArray(const Value *values) noexcept {
+        return reinterpret_cast<const HxOrtValue *>(values);
+    }
+
     static Value Null() noexcept {
         HxOrtValue place;
-        hexagon_ort_value_create_from_null(&place);
+        HX_ORT_FFI(hexagon_ort_value_create_from_null)(&place);
         return Value(place);
     }
 
@@ -75,7 +280,7 @@ public:
         static_assert(std::is_integral<T>::value, "Parameter must be of an integral type");
 
         HxOrtValue place;
-        hexagon_ort_value_create_from_i64(&place, (long long) v);
+        HX_ORT_FFI(hexagon_ort_value_create_from_i64)(&place, (long long) v);
         return Value(place);
     }
 
@@ -83,21 +288,27 @@ public:
         static_assert(std::is_floating_point<T>::value, "Parameter must be of a floating point type");
 
         HxOrtValue place;
-        hexagon_ort_value_create_from_f64(&place, (double) v);
+        HX_ORT_FFI(hexagon_ort_value_create_from_f64)(&place, (double) v);
         return Value(place);
     }
 
     static Value FromBool(bool v) noexcept {
         HxOrtValue place;
-        hexagon_ort_value_create_from_bool(&place, (unsigned int) v);
+        HX_ORT_FFI(hexagon_ort_value_create_from_bool)(&place, (unsigned int) v);
         return Value(place);
     }
 
     static Value FromString(const std::string& s, Runtime& rt);
+    static Value FromString(const char *s, Runtime& rt);
+
+    // Carries the length explicitly. The backend takes NUL-terminated
+    // strings, so short views are terminated in a stack buffer and
+    // embedded NULs are rejected rather than silently truncated.
+    static Value FromString(std::string_view s, Runtime& rt);
 
     long long ExtractI64() const {
         long long ret;
-        int err = hexagon_ort_value_read_i64(&ret, &res);
+        int err = HX_ORT_FFI(hexagon_ort_value_read_i64)(&ret, &res);
         if(err) {
             throw std::runtime_error("Type mismatch");
         }
@@ -106,44 +317,95 @@ public:
 
     double ExtractF64() const {
         double ret;
-        int err = hexagon_ort_value_read_f64(&ret, &res);
+        int err = HX_ORT_FFI(hexagon_ort_value_read_f64)(&ret, &res);
         if(err) {
             throw std::runtime_error("Type mismatch");
         }
         return ret;
     }
 
-    double ToF64() const {
-        switch(Type()) {
+    // Reads the tag and scalar payload together: one type query, then at
+    // most one typed read. Scalars cost two crossings and Null, Object and
+    // unknown types one.
+    DecodedValue Decode() const noexcept {
+        DecodedValue ret;
+        ret.type = Type();
+        switch(ret.type) {
+            case ValueType::Int: {
+                HX_ORT_FFI(hexagon_ort_value_read_i64)(&ret.i64, &res);
+                break;
+            }
             case ValueType::Float: {
-                return ExtractF64();
+                HX_ORT_FFI(hexagon_ort_value_read_f64)(&ret.f64, &res);
+                break;
             }
-            case ValueType::Int: {
-                return (double) ExtractI64();
+            case ValueType::Bool: {
+                int b = 0;
+                HX_ORT_FFI(hexagon_ort_value_read_bool)(&b, &res);
+                ret.b = (bool) b;
+                break;
             }
             default: {
-                throw std::runtime_error("Cannot convert to f64");
+                break;
             }
         }
+        return ret;
     }
 
-    long long ToI64() const {
-        switch(Type()) {
+    // Calls `visitor` with a long long, double, bool, nullptr (for Null),
+    // or the Value itself for objects and unknown types, and returns its
+    // result.
+    template<class V>
+    decltype(auto) Visit(V&& visitor) const {
+        DecodedValue d = Decode();
+        switch(d.type) {
+            case ValueType::Int: {
+                return visitor(d.i64);
+            }
             case ValueType::Float: {
-                return (long long) ExtractF64();
+                return visitor(d.f64);
             }
-            case ValueType::Int: {
-                return ExtractI64();
+            case ValueType::Bool: {
+                return visitor(d.b);
+            }
+            case ValueType::Null: {
+                return visitor(nullptr);
             }
             default: {
-                throw std::runtime_error("Cannot convert to i64");
+                return visitor(*this);
             }
         }
     }
 
+    // Floats are tried first here, so the common case is one crossing.
+    double ToF64() const {
+        double f;
+        if(HX_ORT_FFI(hexagon_ort_value_read_f64)(&f, &res) == 0) {
+            return f;
+        }
+        long long i;
+        if(HX_ORT_FFI(hexagon_ort_value_read_i64)(&i, &res) == 0) {
+            return (double) i;
+        }
+        throw std::runtime_error("Cannot convert to f64");
+    }
+
+    // Ints are tried first here, so the common case is one crossing.
+    long long ToI64() const {
+        long long i;
+        if(HX_ORT_FFI(hexagon_ort_value_read_i64)(&i, &res) == 0) {
+            return i;
+        }
+        double f;
+        if(HX_ORT_FFI(hexagon_ort_value_read_f64)(&f, &res) == 0) {
+            return (long long) f;
+        }
+        throw std::runtime_error("Cannot convert to i64");
+    }
+
     bool ExtractBool() const {
         int ret;
-        int err = hexagon_ort_value_read_bool(&ret, &res);
+        int err = HX_ORT_FFI(hexagon_ort_value_read_bool)(&ret, &res);
         if(err) {
             throw std::runtime_error("Type mismatch");
         }
@@ -152,20 +414,449 @@ public:
 
     bool IsString(Runtime& rt) const;
     std::string ToString(Runtime& rt) const;
+
+    // Takes the backend's copy of the string without copying it again
+    // into a std::string.
+    OwnedCString ReadString(Runtime& rt) const;
+
+    // Copies the string into `buffer`, reusing its capacity. Returns the length.
+    size_t ReadStringInto(Runtime& rt, std::string& buffer) const;
+
     ObjectHandle ToObjectHandle(Runtime& rt) const;
 
+    // Like ToObjectHandle, for handles that only live for a scope. The
+    // handle is released when the borrow ends, so the object is not kept
+    // alive past it. Each borrow is one backend handle allocation: the C
+    // ABI exposes no object identity to cache handles by.
+    BorrowedObjectHandle BorrowObjectHandle(Runtime& rt) const;
+
+    // Typed downcast through a borrowed handle. Returns nullptr for
+    // non-objects and for objects that are not exactly a `T`. The pointer
+    // stays valid for as long as the object is kept alive.
+    template<class T> T * As(Runtime& rt) const;
+
     bool IsNull() const noexcept {
-        int err = hexagon_ort_value_read_null(&res);
+        int err = HX_ORT_FFI(hexagon_ort_value_read_null)(&res);
         return err == 0;
     }
 };
 
+static_assert(
+    sizeof(Value) == sizeof(HxOrtValue) && std::is_standard_layout<Value>::value,
+    "Value must stay layout-compatible with HxOrtValue"
+);
+
 class ProxiedObject;
 
-class ObjectHandle {
+namespace detail {
+    // Compile-time identity of a ProxiedObject subclass: the address of a
+    // per-type static, so comparing two tags is one pointer compare and
+    // needs no RTTI.
+    typedef const void * TypeTag;
+
+    template<class T> struct TypeTagHolder {
+        static constexpr char id = 0;
+    };
+
+    template<class T> constexpr TypeTag type_tag_of() noexcept {
+        return &TypeTagHolder<T>::id;
+    }
+} // namespace detail
+
+// Boundary profiler, compiled in with HX_ORT_ENABLE_PROFILER.
+//
+// Scopes at the native boundaries maintain a per-thread shadow call tree:
+// `vm` around every Runtime::Invoke, `ffi:<name>` around a typed native
+// trampoline (its self time is argument and return marshalling), `<name>`
+// around the native function body, and `<Type>.call` / `<Type>.get_field`
+// around proxy methods. VM re-entry from native code nests naturally.
+//
+// Entering and leaving a scope only moves a pointer and bumps a call
+// count; time comes from a SIGPROF sampler (Profiler::Start) that charges
+// each tick to the frame the interrupted thread is in. That keeps the hot
+// path free of clock reads.
+//
+// Native functions are named after the key they are attached under.
+// Proxied types are named with Profiler::NameType<T>("T"); unnamed ones
+// show up as `proxy`.
+enum class ProfileKind : unsigned char {
+    Vm,
+    Ffi,
+    Native,
+    ProxyCall,
+    ProxyGetField
+};
+
+// Aggregate numbers for one frame label, summed over every call path.
+struct ProfileEntry {
+    std::string name;
+    unsigned long long calls = 0;
+    unsigned long long total_ns = 0;
+    unsigned long long self_ns = 0;
+};
+
+#ifdef HX_ORT_ENABLE_PROFILER
+namespace detail {
+    struct ProfileNode {
+        const void *key;
+        ProfileKind kind;
+        ProfileNode *parent;
+        std::vector<std::unique_ptr<ProfileNode>> children;
+        unsigned long long calls = 0;
+
+        // Written from the signal handler.
+        std::atomic<unsigned long long> samples { 0 };
+
+        ProfileNode(const void *_key, ProfileKind _kind, ProfileNode *_parent)
+            : key(_key), kind(_kind), parent(_parent) {}
+
+        ProfileNode * Child(const void *k, ProfileKind kd) {
+            for(const std::unique_ptr<ProfileNode>& c : children) {
+                if(c -> key == k && c -> kind == kd) {
+                    return c.get();
+                }
+            }
+            children.emplace_back(new ProfileNode(k, kd, this));
+            return children.back().get();
+        }
+    };
+
+    struct ProfileThread {
+        ProfileNode root { nullptr, ProfileKind::Vm, nullptr };
+        // Read by the signal handler; only ever points at a live node.
+        std::atomic<ProfileNode *> current { &root };
+    };
+
+    // Every thread's tree, plus frame names. Trees outlive their threads
+    // so that short-lived workers still show up in the report.
+    struct ProfileRegistry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ProfileThread>> threads;
+        std::unordered_map<const void *, std::string> names;
+        unsigned long long interval_ns = 1000000;
+
+        // Process CPU time spent with the sampler running, for converting
+        // samples to time. The kernel rounds the interval up to its tick.
+        unsigned long long cpu_ns = 0;
+        unsigned long long cpu_start_ns = 0;
+
+        // SIGPROF disposition and ITIMER_PROF setting from before Start(),
+        // put back by Stop().
+        bool installed = false;
+        struct sigaction saved_action;
+        struct itimerval saved_timer;
+
+        static unsigned long long process_cpu_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+            return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        }
+
+        static ProfileRegistry& Get() {
+            static ProfileRegistry r;
+            return r;
+        }
+    };
+
+    // Constant-initialized, so the signal handler can read it safely.
+    inline thread_local ProfileThread *current_profile_thread = nullptr;
+
+    inline ProfileThread& profile_thread() {
+        ProfileThread *t = current_profile_thread;
+        if(t == nullptr) {
+            ProfileRegistry& r = ProfileRegistry::Get();
+            std::lock_guard<std::mutex> lg(r.mutex);
+            r.threads.emplace_back(new ProfileThread());
+            t = r.threads.back().get();
+            current_profile_thread = t;
+        }
+        return *t;
+    }
+
+    inline void profile_signal_handler(int) {
+        ProfileThread *t = current_profile_thread;
+        if(t != nullptr) {
+            t -> current.load(std::memory_order_relaxed) -> samples.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    class ProfileScope {
+    private:
+        ProfileThread& thread;
+        ProfileNode *node;
+
+    public:
+        ProfileScope(const void *key, ProfileKind kind) : thread(profile_thread()) {
+            node = thread.current.load(std::memory_order_relaxed) -> Child(key, kind);
+            node -> calls++;
+            thread.current.store(node, std::memory_order_relaxed);
+        }
+
+        ProfileScope(const ProfileScope& other) = delete;
+
+        ~ProfileScope() {
+            thread.current.store(node -> parent, std::memory_order_relaxed);
+        }
+    };
+} // namespace detail
+
+#define HX_ORT_PROFILE_SCOPE(var, key, kind) ::hexagon::ort::detail::ProfileScope var((key), (kind))
+#else
+#define HX_ORT_PROFILE_SCOPE(var, key, kind) ((void) 0)
+#endif
+
+class Profiler {
 private:
-    HxOrtObjectHandle res;
+#ifdef HX_ORT_ENABLE_PROFILER
+    static std::string frame_name(const detail::ProfileRegistry& r, const detail::ProfileNode& n) {
+        if(n.kind == ProfileKind::Vm) {
+            return "vm";
+        }
+
+        auto it = r.names.find(n.key);
+        std::string base;
+        if(it != r.names.end()) {
+            base = it -> second;
+        } else if(n.kind == ProfileKind::ProxyCall || n.kind == ProfileKind::ProxyGetField) {
+            base = "proxy";
+        } else {
+            base = "native";
+        }
+
+        switch(n.kind) {
+            case ProfileKind::Ffi:
+                return "ffi:" + base;
+            case ProfileKind::ProxyCall:
+                return base + ".call";
+            case ProfileKind::ProxyGetField:
+                return base + ".get_field";
+            default:
+                return base;
+        }
+    }
+
+    // Calls `visit(node, name, path, total_samples)` for every node below
+    // `n` and returns the total samples of `n`'s subtree.
+    template<class F>
+    static unsigned long long walk(const detail::ProfileRegistry& r, const detail::ProfileNode& n, const std::string& path, F& visit) {
+        unsigned long long total = n.samples.load(std::memory_order_relaxed);
+        for(const std::unique_ptr<detail::ProfileNode>& c : n.children) {
+            std::string name = frame_name(r, *c);
+            std::string child_path = path.empty() ? name : path + ";" + name;
+            unsigned long long child_total = walk(r, *c, child_path, visit);
+            visit(*c, name, child_path, child_total);
+            total += child_total;
+        }
+        return total;
+    }
+#endif
+
+public:
+    // Starts sampling every `interval_us` of process CPU time (SIGPROF).
+    // SIGPROF and ITIMER_PROF are process-wide: the previous handler and
+    // timer are saved and put back by Stop(), and are not called while
+    // the profiler runs. Calling Start() again only changes the interval.
+    static void Start([[maybe_unused]] unsigned int interval_us = 1000) {
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+        r.interval_ns = (unsigned long long) interval_us * 1000;
+        if(!r.cpu_start_ns) {
+            r.cpu_start_ns = detail::ProfileRegistry::process_cpu_ns();
+        }
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = interval_us / 1000000;
+        timer.it_interval.tv_usec = interval_us % 1000000;
+        timer.it_value = timer.it_interval;
+
+        if(r.installed) {
+            setitimer(ITIMER_PROF, &timer, nullptr);
+            return;
+        }
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = detail::profile_signal_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, &r.saved_action);
+        setitimer(ITIMER_PROF, &timer, &r.saved_timer);
+        r.installed = true;
+#endif
+    }
+
+    // Stops sampling and restores the SIGPROF handler and timer saved by
+    // Start(). A default (terminating) disposition is restored as
+    // SIG_IGN instead, so a tick already in flight cannot kill the process.
+    static void Stop() {
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+        if(r.installed) {
+            struct itimerval timer;
+            memset(&timer, 0, sizeof(timer));
+            setitimer(ITIMER_PROF, &timer, nullptr);
+
+            struct sigaction restored = r.saved_action;
+            if(!(restored.sa_flags & SA_SIGINFO) && restored.sa_handler == SIG_DFL) {
+                restored.sa_handler = SIG_IGN;
+            }
+            sigaction(SIGPROF, &restored, nullptr);
+            setitimer(ITIMER_PROF, &r.saved_timer, nullptr);
+            r.installed = false;
+        }
+
+        if(r.cpu_start_ns) {
+            r.cpu_ns += detail::ProfileRegistry::process_cpu_ns() - r.cpu_start_ns;
+            r.cpu_start_ns = 0;
+        }
+#endif
+    }
+
+    // Names the frames of native functions and proxies keyed by `key`.
+    // AttachFunction does this automatically for native functions.
+    static void SetName([[maybe_unused]] const void *key, [[maybe_unused]] const std::string& name) {
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+        r.names[key] = name;
+#endif
+    }
+
+    template<class T> static void NameType(const std::string& name) {
+        SetName(detail::type_tag_of<T>(), name);
+    }
+
+    // Brendan Gregg's folded format, one `frame;frame;frame samples` line
+    // per call path with samples, merged across threads. Feed it to
+    // flamegraph.pl. Take reports while no profiled calls are running.
+    static std::string Folded() {
+        std::string out;
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+
+        std::vector<std::pair<std::string, unsigned long long>> lines;
+        std::unordered_map<std::string, size_t> line_ids;
+        auto visit = [&](const detail::ProfileNode& n, const std::string&, const std::string& path, unsigned long long) {
+            unsigned long long self = n.samples.load(std::memory_order_relaxed);
+            if(self == 0) {
+                return;
+            }
+            auto it = line_ids.find(path);
+            if(it != line_ids.end()) {
+                lines[it -> second].second += self;
+            } else {
+                line_ids.emplace(path, lines.size());
+                lines.push_back(std::make_pair(path, self));
+            }
+        };
+        for(const std::unique_ptr<detail::ProfileThread>& t : r.threads) {
+            walk(r, t -> root, std::string(), visit);
+        }
+
+        char buf[24];
+        for(const std::pair<std::string, unsigned long long>& l : lines) {
+            std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), l.second);
+            out += l.first;
+            out += ' ';
+            out.append(buf, res.ptr - buf);
+            out += '\n';
+        }
+#endif
+        return out;
+    }
 
+    // Exact call counts plus sampled total and self time per frame name.
+    // Recursive frames count their total time once per level. Times are
+    // only estimates: samples are scaled by the CPU time measured between
+    // Start() and Stop(), or by the nominal interval while still running.
+    static std::vector<ProfileEntry> Report() {
+        std::vector<ProfileEntry> ret;
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+
+        unsigned long long ns_per_sample = r.interval_ns;
+        if(r.cpu_start_ns == 0 && r.cpu_ns > 0) {
+            unsigned long long n_samples = 0;
+            for(const std::unique_ptr<detail::ProfileThread>& t : r.threads) {
+                auto count = [](const detail::ProfileNode&, const std::string&, const std::string&, unsigned long long) {};
+                n_samples += walk(r, t -> root, std::string(), count);
+            }
+            if(n_samples > 0) {
+                ns_per_sample = r.cpu_ns / n_samples;
+            }
+        }
+
+        auto visit = [&](const detail::ProfileNode& n, const std::string& name, const std::string&, unsigned long long total) {
+            auto it = std::find_if(ret.begin(), ret.end(), [&](const ProfileEntry& e) {
+                return e.name == name;
+            });
+            if(it == ret.end()) {
+                ret.emplace_back();
+                ret.back().name = name;
+                it = ret.end() - 1;
+            }
+            it -> calls += n.calls;
+            it -> total_ns += total * ns_per_sample;
+            it -> self_ns += n.samples.load(std::memory_order_relaxed) * ns_per_sample;
+        };
+        for(const std::unique_ptr<detail::ProfileThread>& t : r.threads) {
+            walk(r, t -> root, std::string(), visit);
+        }
+#endif
+        return ret;
+    }
+
+    // Clears all recorded data. Names are kept. Like the reports, this
+    // must only be called while no thread is inside a profiled call: the
+    // call trees are freed, and a thread walking or sampling into them
+    // would touch freed nodes. A call found in progress throws
+    // std::logic_error, but that check cannot catch a call that starts
+    // while Reset() runs.
+    static void Reset() {
+#ifdef HX_ORT_ENABLE_PROFILER
+        detail::ProfileRegistry& r = detail::ProfileRegistry::Get();
+        std::lock_guard<std::mutex> lg(r.mutex);
+        for(const std::unique_ptr<detail::ProfileThread>& t : r.threads) {
+            if(t -> current.load() != &t -> root) {
+                throw std::logic_error("Profiler::Reset: Profiled call in progress");
+            }
+        }
+        for(const std::unique_ptr<detail::ProfileThread>& t : r.threads) {
+            t -> root.children.clear();
+            t -> root.samples.store(0);
+        }
+        r.cpu_ns = 0;
+        if(r.cpu_start_ns) {
+            r.cpu_start_ns = detail::ProfileRegistry::process_cpu_ns();
+        }
+#endif
+    }
+};
+
+// Operations shared by owning and borrowed object handles.
+class ObjectHandleView {
+protected:
+    HxOrtObjectHandle res = nullptr;
+
+    ObjectHandleView() = default;
+    ObjectHandleView(HxOrtObjectHandle _res) : res(_res) {}
+
+public:
+    ProxiedObject * ToProxiedObject();
+    std::string DumpVirtualFunction();
+    void DebugPrintVirtualFunction();
+
+    // Returns the proxied object if it is exactly a `T` (see
+    // TypedProxiedObject), or nullptr otherwise. Does not use RTTI.
+    template<class T> T * As() noexcept;
+};
+
+class ObjectHandle : public ObjectHandleView {
+private:
     ObjectHandle() = default;
 public:
     ObjectHandle(const ObjectHandle& rvalue) = delete;
@@ -175,30 +866,439 @@ public:
     }
     ~ObjectHandle() {
         if(res != nullptr) {
-            hexagon_ort_object_handle_destroy(res);
+            HX_ORT_FFI(hexagon_ort_object_handle_destroy)(res);
         }
     }
 
-    ProxiedObject * ToProxiedObject();
-    std::string DumpVirtualFunction();
-    void DebugPrintVirtualFunction();
+    friend class Value;
+};
+
+// Scoped object handle from Value::BorrowObjectHandle, released when it
+// goes out of scope. Must not outlive the Runtime.
+class BorrowedObjectHandle : public ObjectHandleView {
+private:
+    BorrowedObjectHandle(HxOrtObjectHandle owned) : ObjectHandleView(owned) {}
 
     friend class Value;
+
+public:
+    BorrowedObjectHandle(const BorrowedObjectHandle& other) = delete;
+    BorrowedObjectHandle& operator = (const BorrowedObjectHandle& other) = delete;
+
+    BorrowedObjectHandle(BorrowedObjectHandle&& other) noexcept
+        : ObjectHandleView(other.res) {
+        other.res = nullptr;
+    }
+
+    ~BorrowedObjectHandle() {
+        if(res != nullptr) {
+            HX_ORT_FFI(hexagon_ort_object_handle_destroy)(res);
+        }
+    }
 };
 
+namespace detail {
+    // Conversions from backend values to the C++ argument types accepted by
+    // typed native functions. Load() returns false on a type mismatch, and
+    // for integers that do not fit the parameter type.
+    template<class T, class = void> struct NativeArg {
+        static_assert(sizeof(T) == 0, "Unsupported native argument type");
+    };
+
+    template<class T> struct NativeArg<T, typename std::enable_if<
+        std::is_integral<T>::value && !std::is_same<T, bool>::value
+    >::type> {
+        T value;
+
+        bool Load(const HxOrtValue *v, HxOrtExecutorImpl) {
+            long long x;
+            if(HX_ORT_FFI(hexagon_ort_value_read_i64)(&x, v) != 0) {
+                return false;
+            }
+            if constexpr (std::is_signed<T>::value) {
+                if(x < (long long) std::numeric_limits<T>::min() || x > (long long) std::numeric_limits<T>::max()) {
+                    return false;
+                }
+            } else {
+                if(x < 0 || (unsigned long long) x > (unsigned long long) std::numeric_limits<T>::max()) {
+                    return false;
+                }
+            }
+            value = (T) x;
+            return true;
+        }
+
+        T Get() {
+            return value;
+        }
+    };
+
+    template<class T> struct NativeArg<T, typename std::enable_if<
+        std::is_floating_point<T>::value
+    >::type> {
+        T value;
+
+        // Accepts ints as well, like Value::ToF64.
+        bool Load(const HxOrtValue *v, HxOrtExecutorImpl) {
+            double x;
+            if(HX_ORT_FFI(hexagon_ort_value_read_f64)(&x, v) == 0) {
+                value = (T) x;
+                return true;
+            }
+            long long i;
+            if(HX_ORT_FFI(hexagon_ort_value_read_i64)(&i, v) == 0) {
+                value = (T) i;
+                return true;
+            }
+            return false;
+        }
+
+        T Get() {
+            return value;
+        }
+    };
+
+    template<> struct NativeArg<bool> {
+        bool value;
+
+        bool Load(const HxOrtValue *v, HxOrtExecutorImpl) {
+            int x;
+            if(HX_ORT_FFI(hexagon_ort_value_read_bool)(&x, v) != 0) {
+                return false;
+            }
+            value = (bool) x;
+            return true;
+        }
+
+        bool Get() {
+            return value;
+        }
+    };
+
+    template<> struct NativeArg<Value> {
+        HxOrtValue value;
+
+        bool Load(const HxOrtValue *v, HxOrtExecutorImpl) {
+            value = *v;
+            return true;
+        }
+
+        Value Get() {
+            return Value(value);
+        }
+    };
+
+    // Valid for the duration of the native call.
+    template<> struct NativeArg<std::string_view> {
+        OwnedCString value;
+
+        bool Load(const HxOrtValue *v, HxOrtExecutorImpl e) {
+            value = OwnedCString(HX_ORT_FFI(hexagon_ort_value_read_string)(v, e));
+            return (bool) value;
+        }
+
+        std::string_view Get() {
+            return value.View();
+        }
+    };
+
+    template<class R>
+    void store_native_return(HxOrtValue *place, const R& v, HxOrtExecutorImpl e) {
+        if constexpr (std::is_same<R, Value>::value) {
+            *place = v.Extract();
+        } else if constexpr (std::is_same<R, bool>::value) {
+            HX_ORT_FFI(hexagon_ort_value_create_from_bool)(place, (unsigned int) v);
+        } else if constexpr (std::is_integral<R>::value) {
+            HX_ORT_FFI(hexagon_ort_value_create_from_i64)(place, (long long) v);
+        } else if constexpr (std::is_floating_point<R>::value) {
+            HX_ORT_FFI(hexagon_ort_value_create_from_f64)(place, (double) v);
+        } else if constexpr (std::is_same<R, std::string>::value) {
+            HX_ORT_FFI(hexagon_ort_value_create_from_string)(place, v.c_str(), e);
+        } else {
+            static_assert(sizeof(R) == 0, "Unsupported native return type");
+        }
+    }
+
+    // Trampoline and storage for a typed native function. Callables that
+    // are trivially copyable and fit in a pointer (captureless lambdas,
+    // lambdas capturing a single reference) are stored in the user data
+    // pointer itself, so loading them does not allocate.
+    template<class F, class R, class... Args>
+    struct NativeBinding {
+        static constexpr bool inline_storage =
+            std::is_trivially_copyable<F>::value
+            && sizeof(F) <= sizeof(void *)
+            && alignof(F) <= alignof(void *);
+
+        template<class G>
+        static void * Pack(G&& f) {
+            if constexpr (inline_storage) {
+                void *data = nullptr;
+                memcpy(&data, &f, sizeof(F));
+                return data;
+            } else {
+                return new F(std::forward<G>(f));
+            }
+        }
+
+        static void Destroy(void *data) {
+            if constexpr (!inline_storage) {
+                delete (F *) data;
+            }
+        }
+
+        static int Fail(HxOrtValue *ret_place, const char *msg) {
+            report_native_error(msg);
+            HX_ORT_FFI(hexagon_ort_value_create_from_null)(ret_place);
+            return 1;
+        }
+
+        // Each argument is fetched with its own get_argument call, so a
+        // native with N parameters crosses the ABI N times before it runs
+        // (plus the typed read inside Load). The ABI has no call that
+        // returns the whole argument array.
+        template<size_t... I>
+        static int Invoke(HxOrtValue *ret_place, HxOrtExecutorImpl e, F& f, std::index_sequence<I...>) {
+            std::tuple<NativeArg<typename std::decay<Args>::type>...> args;
+            HxOrtValue raw;
+
+            bool loaded = ((
+                HX_ORT_FFI(hexagon_ort_executor_impl_get_argument)(&raw, e, I) == 0
+                && std::get<I>(args).Load(&raw, e)
+            ) && ...);
+            if(!loaded) {
+                return Fail(ret_place, "Native function: argument type mismatch or out of range");
+            }
+
+            try {
+                HX_ORT_PROFILE_SCOPE(profile_scope, type_tag_of<NativeBinding>(), ProfileKind::Native);
+                if constexpr (std::is_void<R>::value) {
+                    f(std::get<I>(args).Get()...);
+                    HX_ORT_FFI(hexagon_ort_value_create_from_null)(ret_place);
+                } else {
+                    store_native_return<typename std::decay<R>::type>(ret_place, f(std::get<I>(args).Get()...), e);
+                }
+                return 0;
+            } catch(...) {
+                report_current_exception();
+                HX_ORT_FFI(hexagon_ort_value_create_from_null)(ret_place);
+                return 1;
+            }
+        }
+
+        static int Call(HxOrtValue *ret_place, HxOrtExecutorImpl e, void *data) {
+            HX_ORT_PROFILE_SCOPE(profile_scope, type_tag_of<NativeBinding>(), ProfileKind::Ffi);
+            if(HX_ORT_FFI(hexagon_ort_executor_impl_get_n_arguments)(e) < sizeof...(Args)) {
+                return Fail(ret_place, "Native function: missing arguments");
+            }
+            if constexpr (inline_storage) {
+                return Invoke(ret_place, e, *reinterpret_cast<F *>(&data), std::index_sequence_for<Args...>());
+            } else {
+                return Invoke(ret_place, e, *(F *) data, std::index_sequence_for<Args...>());
+            }
+        }
+    };
+
+    template<class Sig> struct NativeSignature;
+
+    template<class R, class... Args> struct NativeSignature<R (Args...)> {
+        template<class F> using Binding = NativeBinding<F, R, Args...>;
+    };
+} // namespace detail
+
+// Per-function call statistics, as returned by Runtime::Snapshot(). Only
+// collected when ort.h is compiled with HX_ORT_ENABLE_STATS.
+struct FunctionStatsSnapshot {
+    // Log-linear latency buckets: exact below 4 ns, then four buckets per
+    // power of two. The last bucket also holds everything larger.
+    static constexpr unsigned int n_buckets = 160;
+
+    std::string key;
+    unsigned long long calls = 0;
+    unsigned long long total_ns = 0;
+    std::vector<unsigned long long> histogram;
+
+    static unsigned int BucketOf(unsigned long long ns) noexcept {
+        if(ns < 4) {
+            return (unsigned int) ns;
+        }
+        unsigned int msb = 63 - __builtin_clzll(ns);
+        unsigned int id = (msb - 1) * 4 + (unsigned int) ((ns >> (msb - 2)) & 3);
+        return id < n_buckets ? id : n_buckets - 1;
+    }
+
+    static unsigned long long BucketLowerBound(unsigned int id) noexcept {
+        if(id < 4) {
+            return id;
+        }
+        return (unsigned long long) (4 + id % 4) << (id / 4 - 1);
+    }
+
+    // Lower bound of the bucket holding the `q` quantile (0 < q <= 1).
+    unsigned long long Percentile(double q) const noexcept {
+        unsigned long long target = (unsigned long long) (q * calls);
+        unsigned long long seen = 0;
+        for(unsigned int i = 0; i < histogram.size(); i++) {
+            seen += histogram[i];
+            if(seen > target || (seen == calls && seen > 0)) {
+                return BucketLowerBound(i);
+            }
+        }
+        return 0;
+    }
+};
+
+#ifdef HX_ORT_ENABLE_STATS
+namespace detail {
+    static constexpr unsigned int stats_shards = 16;
+
+    // Shard of the calling thread, picked round-robin on the thread's
+    // first call and kept in a thread-local. Up to `stats_shards` threads
+    // never share a shard; beyond that, threads do share one, which the
+    // atomic counters keep correct.
+    inline unsigned int stats_shard_index() noexcept {
+        static std::atomic<unsigned int> next(0);
+        static thread_local unsigned int id = next.fetch_add(1, std::memory_order_relaxed) % stats_shards;
+        return id;
+    }
+
+    struct FunctionStats {
+        struct alignas(64) Shard {
+            std::atomic<unsigned long long> calls { 0 };
+            std::atomic<unsigned long long> total_ns { 0 };
+            std::atomic<unsigned long long> histogram[FunctionStatsSnapshot::n_buckets] = {};
+        };
+
+        std::string key;
+        Shard shards[stats_shards];
+
+        // Set when the function attached under `key` is not native, so
+        // calls to it are timed by Runtime::Invoke through a StaticSlot
+        // rather than by a trampoline. Only accessed under the Runtime's
+        // stats mutex.
+        bool host_timed = false;
+
+        FunctionStats(const std::string& _key) : key(_key) {}
+
+        void Record(unsigned long long ns) noexcept {
+            Shard& s = shards[stats_shard_index()];
+            s.calls.fetch_add(1, std::memory_order_relaxed);
+            s.total_ns.fetch_add(ns, std::memory_order_relaxed);
+            s.histogram[FunctionStatsSnapshot::BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        FunctionStatsSnapshot Snapshot() const {
+            FunctionStatsSnapshot ret;
+            ret.key = key;
+            ret.histogram.resize(FunctionStatsSnapshot::n_buckets);
+            for(const Shard& s : shards) {
+                ret.calls += s.calls.load(std::memory_order_relaxed);
+                ret.total_ns += s.total_ns.load(std::memory_order_relaxed);
+                for(unsigned int i = 0; i < FunctionStatsSnapshot::n_buckets; i++) {
+                    ret.histogram[i] += s.histogram[i].load(std::memory_order_relaxed);
+                }
+            }
+            return ret;
+        }
+    };
+
+    // Times one call into `stats`, if any.
+    class StatsTimer {
+    private:
+        FunctionStats *stats;
+        std::chrono::steady_clock::time_point start_time;
+
+    public:
+        StatsTimer(FunctionStats *_stats) noexcept : stats(_stats) {
+            if(stats) {
+                start_time = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~StatsTimer() {
+            if(stats) {
+                stats -> Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start_time
+                ).count());
+            }
+        }
+    };
+
+    // Wraps a native function's callback so its calls are timed in the
+    // trampoline: calls from bytecode and from the host are both counted.
+    // `stats` is filled in by Runtime::AttachFunction; calls made before
+    // that are not recorded.
+    struct StatsBinding {
+        LocalHxOrtNativeFunction call;
+        LocalHxOrtNativeFunctionDestructor destroy;
+        void *data;
+        std::atomic<FunctionStats *> stats { nullptr };
+
+        static int Call(HxOrtValue *ret_place, HxOrtExecutorImpl e, void *self) {
+            StatsBinding *b = (StatsBinding *) self;
+            StatsTimer timer(b -> stats.load(std::memory_order_relaxed));
+            return b -> call(ret_place, e, b -> data);
+        }
+
+        static void Destroy(void *self) {
+            StatsBinding *b = (StatsBinding *) self;
+            if(b -> destroy) {
+                b -> destroy(b -> data);
+            }
+            delete b;
+        }
+    };
+} // namespace detail
+#endif
+
 class Function {
 private:
     HxOrtFunction res;
+#ifdef HX_ORT_ENABLE_PROFILER
+    // Profiler frame key of a native function; named on attach.
+    const void *profile_key = nullptr;
+#endif
+#ifdef HX_ORT_ENABLE_STATS
+    // Stats wrapper of a native function; pointed at its key's stats on
+    // attach.
+    detail::StatsBinding *stats_binding = nullptr;
+#endif
 
     Function() = default;
     Function(const Function& rvalue) = delete;
 
+    // Every native load goes through here. With HX_ORT_ENABLE_STATS the
+    // callback is wrapped in a detail::StatsBinding.
+    static HxOrtFunction load_native(
+        [[maybe_unused]] Function& ret,
+        LocalHxOrtNativeFunction call,
+        LocalHxOrtNativeFunctionDestructor destroy,
+        void *data
+    ) {
+#ifdef HX_ORT_ENABLE_STATS
+        detail::StatsBinding *binding = new detail::StatsBinding { call, destroy, data };
+        HxOrtFunction v = HX_ORT_FFI(hexagon_ort_function_load_native)(
+            detail::StatsBinding::Call,
+            detail::StatsBinding::Destroy,
+            binding
+        );
+        if(v) {
+            ret.stats_binding = binding;
+        } else {
+            delete binding;
+        }
+        return v;
+#else
+        return HX_ORT_FFI(hexagon_ort_function_load_native)(call, destroy, data);
+#endif
+    }
+
 public:
     Function(Function&& rvalue) = default;
 
     ~Function() {
         if(res != nullptr) {
-            hexagon_ort_function_destroy(res);
+            HX_ORT_FFI(hexagon_ort_function_destroy)(res);
         }
     }
 
@@ -207,14 +1307,14 @@ public:
             throw std::runtime_error("Use of dropped function");
         }
 
-        hexagon_ort_function_enable_optimization(res);
+        HX_ORT_FFI(hexagon_ort_function_enable_optimization)(res);
     }
 
     void BindThis(const Value& v) {
         if(res == nullptr) {
             throw std::runtime_error("Use of dropped function");
         }
-        hexagon_ort_function_bind_this(res, &v.Extract());
+        HX_ORT_FFI(hexagon_ort_function_bind_this)(res, &v.Extract());
     }
 
     Value Pin(Runtime& rt);
@@ -224,7 +1324,7 @@ public:
         const unsigned char *code,
         unsigned int len
     ) {
-        HxOrtFunction v = hexagon_ort_function_load_virtual(
+        HxOrtFunction v = HX_ORT_FFI(hexagon_ort_function_load_virtual)(
             encoding,
             code,
             len
@@ -241,14 +1341,18 @@ public:
         const std::function<Value ()>& cb_ref
     ) {
         std::function<Value ()> *cb_handle = new std::function<Value ()>(cb_ref);
-        HxOrtFunction v = hexagon_ort_function_load_native(
+        Function ret;
+        HxOrtFunction v = load_native(
+            ret,
             [](HxOrtValue *ret_place, HxOrtExecutorImpl _exec_impl, void *cb_ptr) -> int {
                 std::function<Value ()>& cb = *(std::function<Value ()> *)cb_ptr;
                 try {
+                    HX_ORT_PROFILE_SCOPE(profile_scope, cb_ptr, ProfileKind::Native);
                     Value ret = cb();
                     *ret_place = ret.Extract();
                     return 0;
                 } catch(...) {
+                    detail::report_current_exception();
                     *ret_place = Value::Null().Extract();
                     return 1;
                 }
@@ -261,39 +1365,480 @@ public:
         if(!v) {
             throw std::runtime_error("Unable to load native function");
         }
+        ret.res = v;
+#ifdef HX_ORT_ENABLE_PROFILER
+        ret.profile_key = cb_handle;
+#endif
+        return ret;
+    }
+
+    // Typed native function: `LoadNative<long long (long long, long long)>(
+    // [](long long a, long long b) { return a + b; })`. Arguments are
+    // converted to long long / double / bool / std::string_view / Value
+    // before the call, and the return value (Value, arithmetic,
+    // std::string or void) is converted back. A missing argument or a type
+    // mismatch is reported to the backend as an error.
+    template<class Sig, class F>
+    static Function LoadNative(F&& cb) {
+        typedef typename detail::NativeSignature<Sig>::template Binding<typename std::decay<F>::type> Binding;
+
+        void *data = Binding::Pack(std::forward<F>(cb));
         Function ret;
+        HxOrtFunction v = load_native(
+            ret,
+            Binding::Call,
+            Binding::inline_storage ? nullptr : Binding::Destroy,
+            data
+        );
+        if(!v) {
+            Binding::Destroy(data);
+            throw std::runtime_error("Unable to load native function");
+        }
         ret.res = v;
+#ifdef HX_ORT_ENABLE_PROFILER
+        ret.profile_key = detail::type_tag_of<Binding>();
+#endif
         return ret;
     }
 
     friend class Runtime;
 };
 
+namespace detail {
+    // Arguments of a queued call, copied into the ring cell. Up to
+    // `inline_capacity` arguments need no allocation.
+    class AsyncArgs {
+    private:
+        static constexpr unsigned int inline_capacity = 8;
+
+        HxOrtValue inline_args[inline_capacity];
+        std::unique_ptr<HxOrtValue[]> spilled;
+        unsigned int count = 0;
+
+    public:
+        AsyncArgs() = default;
+
+        AsyncArgs(const Value *args, unsigned int n_args) : count(n_args) {
+            HxOrtValue *dst = inline_args;
+            if(n_args > inline_capacity) {
+                spilled.reset(new HxOrtValue[n_args]);
+                dst = spilled.get();
+            }
+            if(n_args > 0) {
+                memcpy(dst, Value::RawArray(args), n_args * sizeof(HxOrtValue));
+            }
+        }
+
+        AsyncArgs(AsyncArgs&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        AsyncArgs& operator=(AsyncArgs&& other) noexcept {
+            memcpy(inline_args, other.inline_args, sizeof(inline_args));
+            spilled = std::move(other.spilled);
+            count = other.count;
+            other.count = 0;
+            return *this;
+        }
+
+        const HxOrtValue * Data() const noexcept {
+            return spilled ? spilled.get() : inline_args;
+        }
+
+        unsigned int Size() const noexcept {
+            return count;
+        }
+
+        void Clear() noexcept {
+            spilled.reset();
+            count = 0;
+        }
+    };
+
+    // One queued call. Either an InvokeAsync call, whose `done` runs on
+    // the executor thread, or a host task (`task` set) run there on
+    // behalf of a synchronous caller on another thread.
+    struct AsyncCall {
+        HxOrtValue target;
+        AsyncArgs args;
+        // Small callables (up to two pointers with libstdc++ and libc++)
+        // are stored inline by std::function and do not allocate.
+        std::function<void (Value)> done;
+        void (*task)(void *) = nullptr;
+        void *task_data = nullptr;
+    };
+
+    // Bounded multi-producer ring (Vyukov) drained by a single executor
+    // thread. Each cell carries a sequence number, so producers only
+    // contend on the enqueue index.
+    class AsyncRing {
+    private:
+        struct Cell {
+            std::atomic<size_t> seq;
+            AsyncCall call;
+        };
+
+        static constexpr size_t capacity = 1024;
+
+        std::unique_ptr<Cell[]> cells;
+        alignas(64) std::atomic<size_t> enqueue_pos { 0 };
+        alignas(64) size_t dequeue_pos = 0;
+
+    public:
+        AsyncRing() : cells(new Cell[capacity]) {
+            for(size_t i = 0; i < capacity; i++) {
+                cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // Returns false when the ring is full.
+        bool TryPush(AsyncCall& call) {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            Cell *cell;
+            for(;;) {
+                cell = &cells[pos & (capacity - 1)];
+                size_t seq = cell -> seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+                if(diff == 0) {
+                    if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            cell -> call = std::move(call);
+            cell -> seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only.
+        bool TryPop(AsyncCall& out) {
+            Cell& cell = cells[dequeue_pos & (capacity - 1)];
+            if(cell.seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+                return false;
+            }
+            out = std::move(cell.call);
+            cell.seq.store(dequeue_pos + capacity, std::memory_order_release);
+            dequeue_pos++;
+            return true;
+        }
+
+        // Consumer only.
+        bool Empty() const {
+            const Cell& cell = cells[dequeue_pos & (capacity - 1)];
+            return cell.seq.load(std::memory_order_acquire) != dequeue_pos + 1;
+        }
+    };
+
+    // Executor thread behind Runtime::InvokeAsync. Started on first use.
+    class AsyncExecutor {
+    private:
+        AsyncRing ring;
+
+        // Calls submitted by the executor thread itself (from `done` or a
+        // native callback) once the ring is full. Waiting for room there
+        // would deadlock, so they queue here instead. Executor thread only.
+        std::deque<AsyncCall> overflow;
+        std::thread thread;
+        std::atomic<bool> stopping { false };
+        std::atomic<bool> sleeping { false };
+        std::mutex sleep_mutex;
+        std::condition_variable sleep_cv;
+
+        // Empty polls before parking. Spinning only pays off when the
+        // producer runs on another core.
+        int spin_limit;
+
+        void run(Runtime& rt);
+
+        static AsyncExecutor *& current() {
+            static thread_local AsyncExecutor *executor = nullptr;
+            return executor;
+        }
+
+        // State shared with a synchronous caller waiting in RunSync.
+        template<class F>
+        struct SyncTask {
+            F *f;
+            std::exception_ptr error;
+            bool finished = false;
+            std::mutex mutex;
+            std::condition_variable cv;
+
+            static void Run(void *self) {
+                SyncTask *t = (SyncTask *) self;
+                try {
+                    (*t -> f)();
+                } catch(...) {
+                    t -> error = std::current_exception();
+                }
+                // Notified under the lock: the waiter owns `t` and may
+                // destroy it as soon as it sees `finished`.
+                std::lock_guard<std::mutex> lg(t -> mutex);
+                t -> finished = true;
+                t -> cv.notify_one();
+            }
+        };
+
+    public:
+        AsyncExecutor(Runtime& rt) : spin_limit(std::thread::hardware_concurrency() > 1 ? 4096 : 0) {
+            thread = std::thread([this, &rt]() {
+                run(rt);
+            });
+        }
+
+        // Runs everything already queued, then joins.
+        ~AsyncExecutor() {
+            {
+                std::lock_guard<std::mutex> lg(sleep_mutex);
+                stopping.store(true);
+            }
+            sleep_cv.notify_one();
+            thread.join();
+        }
+
+        bool IsCurrent() const noexcept {
+            return current() == this;
+        }
+
+        // Runs `f` on the executor thread, after the calls already queued,
+        // and waits for it. Exceptions are rethrown here. Must not be
+        // called from the executor thread.
+        template<class F>
+        void RunSync(F& f) {
+            SyncTask<F> t;
+            t.f = &f;
+            AsyncCall call;
+            call.task = SyncTask<F>::Run;
+            call.task_data = &t;
+            Submit(std::move(call));
+
+            std::unique_lock<std::mutex> lk(t.mutex);
+            t.cv.wait(lk, [&]() { return t.finished; });
+            if(t.error) {
+                std::rethrow_exception(t.error);
+            }
+        }
+
+        void Submit(AsyncCall call) {
+            if(current() == this) {
+                // Keep FIFO order with earlier overflowed calls.
+                if(!overflow.empty() || !ring.TryPush(call)) {
+                    overflow.push_back(std::move(call));
+                }
+                return;
+            }
+            while(!ring.TryPush(call)) {
+                // Full: let the executor catch up.
+                std::this_thread::yield();
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(sleeping.load(std::memory_order_relaxed)) {
+                {
+                    std::lock_guard<std::mutex> lg(sleep_mutex);
+                }
+                sleep_cv.notify_one();
+            }
+        }
+    };
+} // namespace detail
+
+enum class BatchLayout {
+    // args[row * n_cols + col]
+    RowMajor,
+    // args[col * n_rows + row]
+    ColumnMajor
+};
+
+// Pre-resolved handle to a static object, obtained from
+// Runtime::ResolveStatic. Reading through a slot is a pointer load; the
+// name is only looked up when the slot is resolved and whenever a function
+// is attached under the same key, so a slot can be resolved before the
+// function it names exists. Slots are owned by the Runtime and stay valid
+// for its lifetime.
+//
+// Slots only track host-side AttachFunction. Bytecode that rebinds a
+// static with SetStatic is not seen, and the slot keeps the old value,
+// which the backend may since have collected. Call
+// Runtime::RefreshStaticSlots() after running such code.
+class StaticSlot {
+private:
+    struct Data {
+        Value value;
+        bool filled;
+#ifdef HX_ORT_ENABLE_STATS
+        // Stats of a bytecode function attached under the slot's key;
+        // null for natives, which time themselves.
+        detail::FunctionStats *stats = nullptr;
+#endif
+    };
+
+    const Data *data = nullptr;
+
+    StaticSlot(const Data *_data) : data(_data) {}
+
+    friend class Runtime;
+
+public:
+    StaticSlot() = default;
+
+    // Null until something has been attached under the slot's key.
+    const Value& Get() const {
+        if(data == nullptr) {
+            throw std::logic_error("Use of unresolved static slot");
+        }
+        return data -> value;
+    }
+
+    bool IsFilled() const noexcept {
+        return data != nullptr && data -> filled;
+    }
+
+    explicit operator bool() const noexcept {
+        return IsFilled();
+    }
+};
+
 class Runtime {
 private:
     HxOrtExecutor _executor_res;
     HxOrtExecutorImpl executor;
+
+    // Intern table. Keys are views into `interned_keys`, whose elements
+    // never move.
+    std::unordered_map<std::string_view, Value> interned;
+    std::deque<std::string> interned_keys;
+
+    // Static slots by key. Node-based, so slot addresses are stable. Keys
+    // are views into `static_slot_keys`, whose elements never move, so
+    // lookups by `const char *` do not build a std::string.
+    std::unordered_map<std::string_view, StaticSlot::Data> static_slots;
+    std::deque<std::string> static_slot_keys;
+
+#ifdef HX_ORT_ENABLE_STATS
+    // One entry per key a function was attached under, never removed.
+    // Only appended to under `stats_mutex`, which Snapshot() also takes;
+    // trampolines reach their entry through the pointer stored in their
+    // detail::StatsBinding, and static slots through StaticSlot::Data.
+    std::deque<detail::FunctionStats> stats;
+    mutable std::mutex stats_mutex;
+
+    detail::FunctionStats * register_stats(const char *key, bool host_timed) {
+        std::lock_guard<std::mutex> lg(stats_mutex);
+        detail::FunctionStats *entry = nullptr;
+        for(detail::FunctionStats& s : stats) {
+            if(s.key == key) {
+                entry = &s;
+                break;
+            }
+        }
+        if(entry == nullptr) {
+            stats.emplace_back(key);
+            entry = &stats.back();
+        }
+        entry -> host_timed = host_timed;
+        return entry;
+    }
+
+    // Entry a static slot for `key` should time calls into, if any.
+    detail::FunctionStats * host_timed_stats(const char *key) {
+        std::lock_guard<std::mutex> lg(stats_mutex);
+        for(detail::FunctionStats& s : stats) {
+            if(s.key == key) {
+                return s.host_timed ? &s : nullptr;
+            }
+        }
+        return nullptr;
+    }
+#endif
+
+    // Created by the first InvokeAsync; joined first thing in ~Runtime.
+    // Once set, the executor thread owns the backend: see InvokeAsync.
+    std::atomic<detail::AsyncExecutor *> async_executor { nullptr };
+    std::once_flag async_executor_once;
+
+    detail::AsyncExecutor * start_async_executor() {
+        std::call_once(async_executor_once, [this]() {
+            async_executor.store(new detail::AsyncExecutor(*this), std::memory_order_release);
+        });
+        return async_executor.load(std::memory_order_acquire);
+    }
+
+    // The executor, if it owns the backend and this is not its thread.
+    detail::AsyncExecutor * foreign_executor() const noexcept {
+        detail::AsyncExecutor *ex = async_executor.load(std::memory_order_acquire);
+        return ex != nullptr && !ex -> IsCurrent() ? ex : nullptr;
+    }
+
+    void check_owner_thread(const char *what) const {
+        if(foreign_executor() != nullptr) {
+            throw std::logic_error(std::string(what) + ": Runtime is owned by its async executor thread; only Invoke, InvokeBatch and InvokeAsync may be called from other threads");
+        }
+    }
+
+    Value invoke_here(Value obj, const HxOrtValue *args, unsigned int n_args) {
+        HxOrtValue ret_place;
+        HxOrtValue target = obj.Extract();
+
+        HX_ORT_PROFILE_SCOPE(profile_scope, nullptr, ProfileKind::Vm);
+
+        HX_ORT_FFI(hexagon_ort_executor_impl_invoke)(
+            &ret_place,
+            executor,
+            &target,
+            nullptr,
+            n_args > 0 ? args : nullptr,
+            n_args
+        );
+        return Value(ret_place);
+    }
+
+    void refresh_static_slot(const char *key, StaticSlot::Data& slot) {
+        slot.value = GetStaticObject(key);
+        slot.filled = !slot.value.IsNull();
+#ifdef HX_ORT_ENABLE_STATS
+        slot.stats = host_timed_stats(key);
+#endif
+    }
 public:
     Runtime() {
-        _executor_res = hexagon_ort_executor_create();
-        executor = hexagon_ort_executor_get_impl(_executor_res);
+        _executor_res = HX_ORT_FFI(hexagon_ort_executor_create)();
+        executor = HX_ORT_FFI(hexagon_ort_executor_get_impl)(_executor_res);
     }
 
     ~Runtime() {
+        // Drains the queue first; calls still running use the executor.
+        delete async_executor.load();
+        async_executor.store(nullptr);
         if(_executor_res != nullptr) {
-            hexagon_ort_executor_destroy(_executor_res);
+            HX_ORT_FFI(hexagon_ort_executor_destroy)(_executor_res);
         }
     }
 
     HxOrtExecutorImpl _impl_handle() {
+        check_owner_thread("Runtime");
         return executor;
     }
 
     Runtime& AttachFunction(const char *key, Function& f) {
+        check_owner_thread("AttachFunction");
         HxOrtFunction fn_res = f.res;
         f.res = nullptr;
+#ifdef HX_ORT_ENABLE_STATS
+        detail::StatsBinding *stats_binding = f.stats_binding;
+        f.stats_binding = nullptr;
+#endif
+
+#ifdef HX_ORT_ENABLE_PROFILER
+        if(f.profile_key) {
+            Profiler::SetName(f.profile_key, key);
+        }
+#endif
 
-        int ret = hexagon_ort_executor_impl_attach_function(
+        int ret = HX_ORT_FFI(hexagon_ort_executor_impl_attach_function)(
             executor,
             key,
             fn_res
@@ -302,12 +1847,27 @@ public:
             throw std::runtime_error("AttachFunction: Rejected by backend");
         }
 
+#ifdef HX_ORT_ENABLE_STATS
+        // Natives are timed in their trampoline. Bytecode functions have
+        // no such hook, so their host calls are timed in Invoke(StaticSlot).
+        detail::FunctionStats *key_stats = register_stats(key, stats_binding == nullptr);
+        if(stats_binding) {
+            stats_binding -> stats.store(key_stats, std::memory_order_relaxed);
+        }
+#endif
+
+        auto it = static_slots.find(std::string_view(key));
+        if(it != static_slots.end()) {
+            refresh_static_slot(key, it -> second);
+        }
+
         return *this;
     }
 
     Value GetStaticObject(const char *key) {
+        check_owner_thread("GetStaticObject");
         HxOrtValue ret_place;
-        hexagon_ort_executor_impl_get_static_object(
+        HX_ORT_FFI(hexagon_ort_executor_impl_get_static_object)(
             &ret_place,
             executor,
             key
@@ -315,14 +1875,38 @@ public:
         return Value(ret_place);
     }
 
+    // Resolves `key` once and returns a slot that tracks it. Resolving the
+    // same key again returns the same slot.
+    StaticSlot ResolveStatic(const char *key) {
+        check_owner_thread("ResolveStatic");
+        auto it = static_slots.find(std::string_view(key));
+        if(it == static_slots.end()) {
+            static_slot_keys.emplace_back(key);
+            it = static_slots.emplace(std::string_view(static_slot_keys.back()), StaticSlot::Data { Value::Null(), false }).first;
+            refresh_static_slot(key, it -> second);
+        }
+        return StaticSlot(&it -> second);
+    }
+
+    // Re-resolves every slot. Needed after bytecode rebinds statics with
+    // SetStatic, which slots do not track.
+    void RefreshStaticSlots() {
+        check_owner_thread("RefreshStaticSlots");
+        for(auto& entry : static_slots) {
+            refresh_static_slot(entry.first.data(), entry.second);
+        }
+    }
+
     void SetStackLimit(unsigned int limit) {
-        hexagon_ort_executor_impl_set_stack_limit(executor, limit);
+        check_owner_thread("SetStackLimit");
+        HX_ORT_FFI(hexagon_ort_executor_impl_set_stack_limit)(executor, limit);
     }
 
     Value GetArgument(unsigned int id) {
+        check_owner_thread("GetArgument");
         HxOrtValue ret_place;
 
-        int err = hexagon_ort_executor_impl_get_argument(
+        int err = HX_ORT_FFI(hexagon_ort_executor_impl_get_argument)(
             &ret_place,
             executor,
             id
@@ -334,44 +1918,309 @@ public:
         return Value(ret_place);
     }
 
+    // Returns the string value for `s`, creating it on first use. Later
+    // calls with the same contents return the cached Value without
+    // touching the backend or allocating.
+    //
+    // The C ABI cannot pin a plain value, so each interned string is kept
+    // reachable from the VM as the `value` static field of a pinned
+    // holder proxy. Interned strings therefore live as long as the
+    // Runtime, and each distinct string costs one pinned object.
+    Value Intern(std::string_view s);
+
+    // Call statistics for every key a function was attached under.
+    // Natives are timed in their trampoline, so calls from bytecode count
+    // as well as host Invoke calls. Bytecode functions have no hook in the
+    // backend: only host calls made through a StaticSlot for their key
+    // (`rt.Invoke(rt.ResolveStatic("entry"), ...)`) are counted, and calls
+    // from other bytecode or through a plain Value are not. Safe to call
+    // from any thread while the Runtime is in use; counters are read
+    // without stopping writers, so totals may be a few calls apart. Always
+    // empty unless compiled with HX_ORT_ENABLE_STATS.
+    std::vector<FunctionStatsSnapshot> Snapshot() const {
+        std::vector<FunctionStatsSnapshot> ret;
+#ifdef HX_ORT_ENABLE_STATS
+        std::lock_guard<std::mutex> lg(stats_mutex);
+        for(const detail::FunctionStats& s : stats) {
+            ret.push_back(s.Snapshot());
+        }
+#endif
+        return ret;
+    }
+
     unsigned int GetNArguments() {
-        return hexagon_ort_executor_impl_get_n_arguments(executor);
+        check_owner_thread("GetNArguments");
+        return HX_ORT_FFI(hexagon_ort_executor_impl_get_n_arguments)(executor);
+    }
+
+    // Passes `args` straight through to the backend without copying.
+    //
+    // Once InvokeAsync has started the executor, calls from other threads
+    // are run on the executor thread and wait for it, in order with the
+    // queued async calls.
+    Value Invoke(Value obj, const HxOrtValue *args, unsigned int n_args) {
+        if(detail::AsyncExecutor *ex = foreign_executor()) {
+            Value ret(HxOrtValue {});
+            auto task = [&]() {
+                ret = invoke_here(obj, args, n_args);
+            };
+            ex -> RunSync(task);
+            return ret;
+        }
+        return invoke_here(obj, args, n_args);
+    }
+
+    Value Invoke(Value obj, const Value *args, unsigned int n_args) {
+        return Invoke(obj, Value::RawArray(args), n_args);
     }
 
     Value Invoke(Value obj, const std::vector<Value>& params) {
-        HxOrtValue ret_place;
+        return Invoke(obj, params.data(), params.size());
+    }
+
+    // Calls `target` once per row of the n_rows x n_cols matrix `args` and
+    // writes each return value to `results[row]`.
+    //
+    // A convenience loop, not a batched call: the C ABI has no batch entry
+    // point, so every row is still one hexagon_ort_executor_impl_invoke
+    // crossing, and the cost per row is that of Invoke minus the wrapper
+    // work around it. Row-major rows are passed to the backend in place;
+    // column-major rows are gathered into a scratch buffer first.
+    //
+    // A row fails when a native callback reported an error during it; its
+    // result is set to Null. The invoke call returns nothing, so errors
+    // raised inside the VM itself cannot be seen here and those rows keep
+    // whatever the backend wrote. If `row_errors` is given,
+    // row_errors[row] is set for failed rows. Returns the number of failed
+    // rows.
+    size_t InvokeBatch(
+        Value target,
+        const Value *args,
+        size_t n_rows,
+        unsigned int n_cols,
+        Value *results,
+        bool *row_errors = nullptr,
+        BatchLayout layout = BatchLayout::RowMajor
+    ) {
+        if(detail::AsyncExecutor *ex = foreign_executor()) {
+            size_t ret = 0;
+            auto task = [&]() {
+                ret = InvokeBatch(target, args, n_rows, n_cols, results, row_errors, layout);
+            };
+            ex -> RunSync(task);
+            return ret;
+        }
+
+        HxOrtValue raw_target = target.Extract();
+        const HxOrtValue *raw_args = Value::RawArray(args);
+        HxOrtValue *raw_results = reinterpret_cast<HxOrtValue *>(results);
+
+        HxOrtValue stack_row[16];
+        std::vector<HxOrtValue> heap_row;
+        HxOrtValue *row_buf = stack_row;
+        if(layout == BatchLayout::ColumnMajor && n_cols > 16) {
+            heap_row.resize(n_cols);
+            row_buf = heap_row.data();
+        }
 
-        std::vector<HxOrtValue> args(params.size());
-        HxOrtValue *raw_args = NULL;
+        unsigned long long& errors = detail::native_error_count();
+        size_t n_failed = 0;
 
-        if(params.size() > 0) {
-            for(size_t i = 0; i < params.size(); i++) {
-                args[i] = params[i].Extract();
+        for(size_t row = 0; row < n_rows; row++) {
+            const HxOrtValue *row_args;
+            if(layout == BatchLayout::RowMajor) {
+                row_args = raw_args + row * n_cols;
+            } else {
+                for(unsigned int col = 0; col < n_cols; col++) {
+                    row_buf[col] = raw_args[col * n_rows + row];
+                }
+                row_args = row_buf;
+            }
+
+            unsigned long long errors_before = errors;
+            {
+                HX_ORT_PROFILE_SCOPE(profile_scope, nullptr, ProfileKind::Vm);
+                HX_ORT_FFI(hexagon_ort_executor_impl_invoke)(
+                    &raw_results[row],
+                    executor,
+                    &raw_target,
+                    nullptr,
+                    n_cols > 0 ? row_args : nullptr,
+                    n_cols
+                );
+            }
+
+            bool failed = errors != errors_before;
+            if(failed) {
+                HX_ORT_FFI(hexagon_ort_value_create_from_null)(&raw_results[row]);
+                n_failed++;
+            }
+            if(row_errors) {
+                row_errors[row] = failed;
             }
-            raw_args = &args[0];
         }
 
-        HxOrtValue target = obj.Extract();
+        return n_failed;
+    }
 
-        hexagon_ort_executor_impl_invoke(
-            &ret_place,
-            executor,
-            &target,
-            nullptr,
-            raw_args,
-            args.size()
-        );
-        return Value(ret_place);
+    // `rt.Invoke(f, a, b, ...)`: arguments are packed into a stack array.
+    template<class... Args, class = typename std::enable_if<
+        std::conjunction<std::is_convertible<const Args&, Value>...>::value
+    >::type>
+    Value Invoke(Value obj, const Args&... args) {
+        if constexpr (sizeof...(Args) == 0) {
+            return Invoke(obj, (const HxOrtValue *) nullptr, 0);
+        } else {
+            HxOrtValue raw_args[] = { Value(args).Extract()... };
+            return Invoke(obj, raw_args, sizeof...(Args));
+        }
+    }
+
+    template<class... Args>
+    Value Invoke(const StaticSlot& slot, const Args&... args) {
+        if(!slot) {
+            throw std::runtime_error("Invoke: Static slot is empty");
+        }
+#ifdef HX_ORT_ENABLE_STATS
+        detail::StatsTimer timer(slot.data -> stats);
+#endif
+        return Invoke(slot.Get(), args...);
+    }
+
+    // Queues a call for this Runtime's executor thread and returns at once.
+    // `done` receives the result on that thread and may itself call
+    // InvokeAsync. Arguments are copied into the queue, inline for up to 8
+    // of them, so they need not outlive the call.
+    //
+    // The executor is started by the first InvokeAsync and owns the
+    // backend from then on. Other threads may still call Invoke and
+    // InvokeBatch, which run on the executor thread and wait for it, and
+    // InvokeAsync; everything else on this Runtime (and on Values, handles
+    // and slots that need it) throws std::logic_error off the executor
+    // thread. Resolve targets before the first call.
+    void InvokeAsync(Value target, const Value *args, unsigned int n_args, std::function<void (Value)> done) {
+        submit_async(target, detail::AsyncArgs(args, n_args), std::move(done));
+    }
+
+    void InvokeAsync(Value target, std::initializer_list<Value> args, std::function<void (Value)> done) {
+        submit_async(target, detail::AsyncArgs(args.begin(), args.size()), std::move(done));
+    }
+
+    void InvokeAsync(Value target, const std::vector<Value>& args, std::function<void (Value)> done) {
+        submit_async(target, detail::AsyncArgs(args.data(), args.size()), std::move(done));
+    }
+
+private:
+    void submit_async(Value target, detail::AsyncArgs&& args, std::function<void (Value)>&& done) {
+        detail::AsyncCall call;
+        call.target = target.Extract();
+        call.args = std::move(args);
+        call.done = std::move(done);
+        start_async_executor() -> Submit(std::move(call));
+    }
+
+public:
+#ifdef HX_ORT_HAS_COROUTINES
+    // `Value v = co_await rt.InvokeAsync(f, { ... });`. The coroutine
+    // resumes on the executor thread.
+    class InvokeAwaitable {
+    private:
+        Runtime& rt;
+        Value target;
+        detail::AsyncArgs args;
+        Value result;
+
+    public:
+        InvokeAwaitable(Runtime& _rt, Value _target, detail::AsyncArgs&& _args)
+            : rt(_rt), target(_target), args(std::move(_args)), result(HxOrtValue()) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            // The coroutine may resume on the executor before this returns,
+            // so nothing here touches `this` once the call is queued.
+            rt.submit_async(target, std::move(args), [this, h](Value ret) {
+                result = ret;
+                h.resume();
+            });
+        }
+
+        Value await_resume() const noexcept {
+            return result;
+        }
+    };
+
+    InvokeAwaitable InvokeAsync(Value target, std::initializer_list<Value> args = {}) {
+        return InvokeAwaitable(*this, target, detail::AsyncArgs(args.begin(), args.size()));
+    }
+
+    InvokeAwaitable InvokeAsync(Value target, const std::vector<Value>& args) {
+        return InvokeAwaitable(*this, target, detail::AsyncArgs(args.data(), args.size()));
     }
+#endif
 };
 
 class ObjectProxy;
 
+// Non-owning view of the arguments passed to a proxied object's Call.
+// Points straight at the backend's argument array; valid only for the
+// duration of the call.
+class ArgSpan {
+private:
+    const Value *args;
+    size_t n_args;
+
+public:
+    ArgSpan(const HxOrtValue *_args, size_t _n_args)
+        : args(reinterpret_cast<const Value *>(_args)), n_args(_n_args) {}
+
+    size_t size() const noexcept {
+        return n_args;
+    }
+
+    bool empty() const noexcept {
+        return n_args == 0;
+    }
+
+    const Value& operator[](size_t i) const noexcept {
+        return args[i];
+    }
+
+    const Value& at(size_t i) const {
+        if(i >= n_args) {
+            throw std::out_of_range("Argument index out of bound");
+        }
+        return args[i];
+    }
+
+    const Value * begin() const noexcept {
+        return args;
+    }
+
+    const Value * end() const noexcept {
+        return args + n_args;
+    }
+};
+
+// Thrown by ProxiedObject::GetField for names the object does not have.
+class FieldNotFound : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class ProxiedObject {
 private:
     HxOrtObjectProxy proxy = nullptr;
+    detail::TypeTag type_tag = nullptr;
 
 protected:
+    // Set by TypedProxiedObject; the most derived constructor wins.
+    void SetTypeTag(detail::TypeTag tag) noexcept {
+        type_tag = tag;
+    }
+
     bool IsInitialized() {
         if(proxy) {
             return true;
@@ -383,14 +2232,14 @@ protected:
         if(!proxy) {
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
-        hexagon_ort_object_proxy_freeze(proxy);
+        HX_ORT_FFI(hexagon_ort_object_proxy_freeze)(proxy);
     }
 
     void AddConstField(const std::string& name) {
         if(!proxy) {
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
-        hexagon_ort_object_proxy_add_const_field(proxy, name.c_str());
+        HX_ORT_FFI(hexagon_ort_object_proxy_add_const_field)(proxy, name.c_str());
     }
 
     void SetStaticField(const std::string& k, const Value& v) {
@@ -398,12 +2247,16 @@ protected:
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
 
-        hexagon_ort_object_proxy_set_static_field(proxy, k.c_str(), &v.Extract());
+        HX_ORT_FFI(hexagon_ort_object_proxy_set_static_field)(proxy, k.c_str(), &v.Extract());
     }
 
 public:
     virtual ~ProxiedObject() {};
 
+    detail::TypeTag GetTypeTag() const noexcept {
+        return type_tag;
+    }
+
     void __HxOnAttachToProxy(HxOrtObjectProxy _proxy) {
         proxy = _proxy;
     }
@@ -412,13 +2265,68 @@ public:
 
     }
 
+    // Called by the on_call trampoline. Override this one; the default
+    // copies the arguments into a vector for subclasses that only
+    // implement the vector overload below. Subclasses overriding only one
+    // overload should add `using ort::ProxiedObject::Call;` so the other
+    // stays visible.
+    virtual Value Call(ArgSpan args) {
+        return Call(std::vector<Value>(args.begin(), args.end()));
+    }
+
     virtual Value Call(const std::vector<Value>& args) {
         throw std::runtime_error("Call: Not implemented");
     };
 
-    virtual Value GetField(const char *name) {
-        throw std::runtime_error("GetField: Not implemented");
+    // Subclasses may fall back to this for unknown names. Throw
+    // FieldNotFound (rather than another exception) for a miss, so that
+    // TryGetField reports it as NotFound instead of Error.
+    virtual Value GetField(const char *) {
+        throw FieldNotFound("GetField: Not implemented");
     };
+
+    // Exception-free entry points used by the ObjectProxy trampolines. On
+    // failure they leave a message in ErrorSlot::Current(). The defaults
+    // adapt the throwing Call/GetField above; override these to keep
+    // errors off the exception path.
+    virtual Status TryCall(ArgSpan args, Value& out) noexcept {
+        return detail::capture_status("Call: Unknown exception", [&]() {
+            out = Call(args);
+        });
+    }
+
+    // The default maps FieldNotFound from GetField to NotFound, which
+    // still costs a throw per miss. Objects that miss often should
+    // override this and report misses directly, as FieldDispatchedObject
+    // does.
+    virtual Status TryGetField(const char *name, Value& out) noexcept {
+        bool missed = false;
+        Status ret = detail::capture_status("GetField: Unknown exception", [&]() {
+            try {
+                out = GetField(name);
+            } catch(const FieldNotFound&) {
+                missed = true;
+            }
+        });
+        if(missed) {
+            ErrorSlot::Current().Set("GetField: Unknown field ", name);
+            return Status::NotFound;
+        }
+        return ret;
+    }
+};
+
+// Base for proxied objects that support ObjectHandle::As<T>():
+//
+//     class Adder : public ort::TypedProxiedObject<Adder> { ... };
+//
+// `Base` lets the tag be added on top of another ProxiedObject subclass.
+template<class T, class Base = ProxiedObject>
+class TypedProxiedObject : public Base {
+public:
+    TypedProxiedObject() {
+        this -> SetTypeTag(detail::type_tag_of<T>());
+    }
 };
 
 class ObjectProxy final {
@@ -433,52 +2341,45 @@ public:
     }
 
     ObjectProxy(ProxiedObject *proxied) {
-        proxy = hexagon_ort_object_proxy_create((void *) &*proxied);
-        hexagon_ort_object_proxy_set_destructor(proxy, [](
+        proxy = HX_ORT_FFI(hexagon_ort_object_proxy_create)((void *) &*proxied);
+        HX_ORT_FFI(hexagon_ort_object_proxy_set_destructor)(proxy, [](
             void *data
         ) {
             ProxiedObject *proxied = (ProxiedObject *) data;
             delete proxied;
         });
-        hexagon_ort_object_proxy_set_on_call(proxy, [](
+        HX_ORT_FFI(hexagon_ort_object_proxy_set_on_call)(proxy, [](
             HxOrtValue *place,
             void *data,
             unsigned int n_args,
             const HxOrtValue *args
         ) -> int {
             ProxiedObject *proxied = (ProxiedObject *) data;
+            HX_ORT_PROFILE_SCOPE(profile_scope, proxied -> GetTypeTag(), ProfileKind::ProxyCall);
 
-            std::vector<Value> target_args;
-            for(unsigned int i = 0; i < n_args; i++) {
-                target_args.push_back(args[i]);
-            }
-            try {
-                Value ret = proxied -> Call(target_args);
-                *place = ret.Extract();
-                return 0;
-            } catch(const std::exception& e) {
-                std::cerr << e.what() << std::endl;
-                return 1;
-            } catch(...) {
+            Value ret = Value(HxOrtValue());
+            if(proxied -> TryCall(ArgSpan(args, n_args), ret) != Status::Ok) {
+                detail::native_error_count()++;
                 return 1;
             }
+            *place = ret.Extract();
+            return 0;
         });
-        hexagon_ort_object_proxy_set_on_get_field(proxy, [](
+        HX_ORT_FFI(hexagon_ort_object_proxy_set_on_get_field)(proxy, [](
             HxOrtValue *place,
             void *data,
             const char *field_name
         ) -> int {
             ProxiedObject *proxied = (ProxiedObject *) data;
-            try {
-                Value ret = proxied -> GetField(field_name);
-                *place = ret.Extract();
-                return 0;
-            } catch(const std::exception& e) {
-                std::cerr << e.what() << std::endl;
-                return 1;
-            } catch(...) {
+            HX_ORT_PROFILE_SCOPE(profile_scope, proxied -> GetTypeTag(), ProfileKind::ProxyGetField);
+
+            Value ret = Value(HxOrtValue());
+            if(proxied -> TryGetField(field_name, ret) != Status::Ok) {
+                detail::native_error_count()++;
                 return 1;
             }
+            *place = ret.Extract();
+            return 0;
         });
         proxied -> __HxOnAttachToProxy(proxy);
         proxied -> Init(*this);
@@ -489,7 +2390,7 @@ public:
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
 
-        hexagon_ort_object_proxy_set_static_field(proxy, k.c_str(), &v.Extract());
+        HX_ORT_FFI(hexagon_ort_object_proxy_set_static_field)(proxy, k.c_str(), &v.Extract());
     }
 
     Value Pin(Runtime& rt) {
@@ -498,7 +2399,7 @@ public:
         }
 
         HxOrtValue ret;
-        hexagon_ort_executor_pin_object_proxy(
+        HX_ORT_FFI(hexagon_ort_executor_pin_object_proxy)(
             &ret,
             rt._impl_handle(),
             proxy
@@ -511,24 +2412,360 @@ public:
         if(!proxy) {
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
-        hexagon_ort_object_proxy_freeze(proxy);
+        HX_ORT_FFI(hexagon_ort_object_proxy_freeze)(proxy);
     }
 
     void AddConstField(const std::string& name) {
         if(!proxy) {
             throw std::logic_error("Attempting to use an object proxy after drop");
         }
-        hexagon_ort_object_proxy_add_const_field(proxy, name.c_str());
+        HX_ORT_FFI(hexagon_ort_object_proxy_add_const_field)(proxy, name.c_str());
     }
 
     ~ObjectProxy() {
         if(proxy) {
             // The proxied object will be destroyed in the destructor callback
-            hexagon_ort_object_proxy_destroy(proxy);
+            HX_ORT_FFI(hexagon_ort_object_proxy_destroy)(proxy);
+        }
+    }
+};
+
+// Field name -> getter table for one ProxiedObject subclass. Build()
+// computes a perfect hash over the declared names (hash and displace), so
+// Find() is one pass over the incoming name, two table reads and a final
+// comparison to reject unknown names. The hash is not minimal: the slot
+// array is kept at most half full so displacements are found quickly.
+// If no seed works within max_seeds attempts, Build() gives up on hashing
+// and Find() binary-searches the names instead.
+template<class T>
+class FieldTable {
+public:
+    typedef Value (T::*Getter)();
+
+    static constexpr unsigned long long max_seeds = 32;
+
+private:
+    friend struct FieldTableTest;
+
+    struct Entry {
+        std::string name;
+        Getter getter;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<unsigned int> displacements;
+    std::vector<int> slots; // index into entries, -1 for empty
+    unsigned int bucket_mask = 0;
+    unsigned int slot_mask = 0;
+    unsigned long long seed = 0;
+    bool sorted = false;
+
+    static unsigned long long hash(const char *name, size_t& len, unsigned long long seed) {
+        unsigned long long h = 14695981039346656037ULL ^ seed;
+        const char *p = name;
+        for(; *p; p++) {
+            h = (h ^ (unsigned char) *p) * 1099511628211ULL;
+        }
+        len = p - name;
+
+        // FNV's low bits mix poorly; finalize so bucket and slot bits both
+        // depend on the whole name.
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static unsigned int slot_of(unsigned long long h, unsigned int displacement) {
+        unsigned int x = (unsigned int) h + displacement * 0x9e3779b9u;
+        x ^= x >> 16;
+        x *= 0x85ebca6bu;
+        x ^= x >> 13;
+        x *= 0xc2b2ae35u;
+        x ^= x >> 16;
+        return x;
+    }
+
+    static unsigned int next_pow2(size_t n) {
+        unsigned int ret = 1;
+        while(ret < n) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    bool try_build(unsigned int n_buckets, unsigned int n_slots) {
+        std::vector<std::vector<int>> buckets(n_buckets);
+        std::vector<unsigned long long> hashes(entries.size());
+
+        for(size_t i = 0; i < entries.size(); i++) {
+            size_t len;
+            hashes[i] = hash(entries[i].name.c_str(), len, seed);
+            buckets[(hashes[i] >> 32) & (n_buckets - 1)].push_back((int) i);
+        }
+
+        std::vector<unsigned int> order(n_buckets);
+        for(unsigned int i = 0; i < n_buckets; i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        displacements.assign(n_buckets, 0);
+        slots.assign(n_slots, -1);
+
+        for(unsigned int b : order) {
+            if(buckets[b].empty()) {
+                break;
+            }
+
+            bool placed = false;
+            for(unsigned int d = 0; d < 4096 && !placed; d++) {
+                placed = true;
+                for(size_t i = 0; i < buckets[b].size() && placed; i++) {
+                    unsigned int slot = slot_of(hashes[buckets[b][i]], d) & (n_slots - 1);
+                    if(slots[slot] != -1) {
+                        placed = false;
+                    }
+                    // Keys of the same bucket must not collide with each other either.
+                    for(size_t j = 0; j < i && placed; j++) {
+                        if((slot_of(hashes[buckets[b][j]], d) & (n_slots - 1)) == slot) {
+                            placed = false;
+                        }
+                    }
+                }
+                if(placed) {
+                    for(int id : buckets[b]) {
+                        slots[slot_of(hashes[id], d) & (n_slots - 1)] = id;
+                    }
+                    displacements[b] = d;
+                }
+            }
+            if(!placed) {
+                return false;
+            }
+        }
+
+        bucket_mask = n_buckets - 1;
+        slot_mask = n_slots - 1;
+        return true;
+    }
+
+    const Entry * probe(const char *name, size_t& len) const {
+        if(slots.empty()) {
+            return nullptr;
+        }
+
+        unsigned long long h = hash(name, len, seed);
+        unsigned int d = displacements[(h >> 32) & bucket_mask];
+        int id = slots[slot_of(h, d) & slot_mask];
+        return id < 0 ? nullptr : &entries[id];
+    }
+
+    void build_sorted() {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.name < b.name;
+        });
+        displacements.clear();
+        slots.clear();
+        sorted = true;
+    }
+
+    const Entry * find_sorted(const char *name) const {
+        auto it = std::lower_bound(entries.begin(), entries.end(), name, [](const Entry& e, const char *key) {
+            return e.name.compare(key) < 0;
+        });
+        if(it == entries.end() || it -> name.compare(name) != 0) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    // The declared name whose slot `name` hashes to, or nullptr if the
+    // slot is empty. Equals `name` exactly when Find() succeeds; used by
+    // FieldTableTest to pick unknown names that reach the final comparison.
+    const char * SlotOwner(const char *name) const {
+        size_t len;
+        const Entry *e = probe(name, len);
+        return e ? e -> name.c_str() : nullptr;
+    }
+
+public:
+    FieldTable& Field(const std::string& name, Getter getter) {
+        for(auto& e : entries) {
+            if(e.name == name) {
+                throw std::logic_error("Duplicate field: " + name);
+            }
+        }
+        entries.push_back(Entry { name, getter });
+        return *this;
+    }
+
+    void Build() {
+        unsigned int n_slots = next_pow2(entries.size() * 2);
+        unsigned int n_buckets = next_pow2(entries.size() / 2 + 1);
+
+        for(seed = 0; !try_build(n_buckets, n_slots); seed++) {
+            if(seed + 1 == max_seeds) {
+                build_sorted();
+                return;
+            }
+            if(seed % 8 == 7) {
+                n_slots <<= 1;
+            }
+        }
+        sorted = false;
+    }
+
+    // Returns nullptr for unknown names.
+    Getter Find(const char *name) const {
+        if(sorted) {
+            const Entry *e = find_sorted(name);
+            return e ? e -> getter : nullptr;
+        }
+
+        size_t len;
+        const Entry *e = probe(name, len);
+        if(!e || e -> name.size() != len || memcmp(e -> name.data(), name, len) != 0) {
+            return nullptr;
+        }
+        return e -> getter;
+    }
+
+    size_t Size() const {
+        return entries.size();
+    }
+};
+
+// Base for proxied objects that dispatch GetField through a per-type
+// FieldTable. T declares its fields once in
+// `static void DeclareFields(FieldTable<T>& fields)`; the table is built
+// when the first instance is initialized.
+template<class T>
+class FieldDispatchedObject : public ProxiedObject {
+public:
+    FieldDispatchedObject() {
+        SetTypeTag(detail::type_tag_of<T>());
+    }
+
+    static const FieldTable<T>& Fields() {
+        static const FieldTable<T> table = []() {
+            FieldTable<T> t;
+            T::DeclareFields(t);
+            t.Build();
+            return t;
+        }();
+        return table;
+    }
+
+    // Subclasses overriding Init should call this one too.
+    virtual void Init(ObjectProxy&) override {
+        Fields();
+    }
+
+    virtual Value GetField(const char *name) override {
+        typename FieldTable<T>::Getter getter = Fields().Find(name);
+        if(!getter) {
+            throw FieldNotFound("GetField: Unknown field");
+        }
+        return (static_cast<T *>(this) ->* getter)();
+    }
+
+    // Misses are reported without throwing.
+    virtual Status TryGetField(const char *name, Value& out) noexcept override {
+        typename FieldTable<T>::Getter getter = Fields().Find(name);
+        if(!getter) {
+            ErrorSlot::Current().Set("GetField: Unknown field ", name);
+            return Status::NotFound;
         }
+        return detail::capture_status("GetField: Unknown exception", [&]() {
+            out = (static_cast<T *>(this) ->* getter)();
+        });
     }
 };
 
+void detail::AsyncExecutor::run(Runtime& rt) {
+    AsyncCall call;
+    current() = this;
+
+    auto execute = [&]() {
+        if(call.task) {
+            call.task(call.task_data);
+            return;
+        }
+        Value ret = rt.Invoke(Value(call.target), call.args.Data(), call.args.Size());
+        std::function<void (Value)> done = std::move(call.done);
+        call.args.Clear();
+        if(done) {
+            try {
+                done(ret);
+            } catch(...) {
+                report_current_exception();
+            }
+        }
+    };
+
+    for(;;) {
+        bool ran = false;
+        while(ring.TryPop(call)) {
+            ran = true;
+            execute();
+        }
+        if(!overflow.empty()) {
+            call = std::move(overflow.front());
+            overflow.pop_front();
+            execute();
+            continue;
+        }
+        if(ran) {
+            continue;
+        }
+
+        // Spin briefly before parking; back-to-back calls are common.
+        for(int i = 0; i < spin_limit && ring.Empty(); i++) {}
+        if(!ring.Empty()) {
+            continue;
+        }
+        if(stopping.load()) {
+            break;
+        }
+
+        std::unique_lock<std::mutex> lk(sleep_mutex);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        sleep_cv.wait(lk, [this]() {
+            return !ring.Empty() || stopping.load();
+        });
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+namespace detail {
+    // Owner of an interned string; see Runtime::Intern.
+    class InternHolder : public ProxiedObject {};
+} // namespace detail
+
+Value Runtime::Intern(std::string_view s) {
+    check_owner_thread("Intern");
+    auto it = interned.find(s);
+    if(it != interned.end()) {
+        return it -> second;
+    }
+
+    Value v = Value::FromString(s, *this);
+    ObjectProxy holder(new detail::InternHolder());
+    holder.SetStaticField("value", v);
+    holder.Freeze();
+    holder.Pin(*this);
+
+    interned_keys.emplace_back(s);
+    interned.emplace(interned_keys.back(), v);
+    return v;
+}
+
 Value Function::Pin(Runtime& rt) {
     if(res == nullptr) {
         throw std::runtime_error("Use of dropped function");
@@ -536,7 +2773,7 @@ Value Function::Pin(Runtime& rt) {
 
     HxOrtValue place;
 
-    hexagon_ort_executor_pin_function(
+    HX_ORT_FFI(hexagon_ort_executor_pin_function)(
         &place,
         rt._impl_handle(),
         res
@@ -547,70 +2784,131 @@ Value Function::Pin(Runtime& rt) {
 }
 
 Value Value::FromString(const std::string& s, Runtime& rt) {
+    if(memchr(s.data(), 0, s.size()) != nullptr) {
+        throw std::invalid_argument("FromString: embedded NUL");
+    }
+    return FromString(s.c_str(), rt);
+}
+
+Value Value::FromString(const char *s, Runtime& rt) {
     HxOrtValue place;
-    hexagon_ort_value_create_from_string(
+    HX_ORT_FFI(hexagon_ort_value_create_from_string)(
         &place,
-        s.c_str(),
+        s,
         rt._impl_handle()
     );
     return Value(place);
 }
 
+Value Value::FromString(std::string_view s, Runtime& rt) {
+    if(memchr(s.data(), 0, s.size()) != nullptr) {
+        throw std::invalid_argument("FromString: embedded NUL");
+    }
+
+    char buf[256];
+    if(s.size() < sizeof(buf)) {
+        memcpy(buf, s.data(), s.size());
+        buf[s.size()] = 0;
+        return FromString((const char *) buf, rt);
+    } else {
+        std::string copy(s);
+        return FromString(copy.c_str(), rt);
+    }
+}
+
 std::string Value::ToString(Runtime& rt) const {
-    char *v = hexagon_ort_value_read_string(
+    OwnedCString s = ReadString(rt);
+    return std::string(s.data(), s.size());
+}
+
+OwnedCString Value::ReadString(Runtime& rt) const {
+    char *v = HX_ORT_FFI(hexagon_ort_value_read_string)(
         &res,
         rt._impl_handle()
     );
     if(!v) {
         throw std::runtime_error("Cannot convert to string");
     }
-    std::string ret = v;
-    hexagon_glue_destroy_cstring(v);
-    return ret;
+    return OwnedCString(v);
+}
+
+size_t Value::ReadStringInto(Runtime& rt, std::string& buffer) const {
+    OwnedCString s = ReadString(rt);
+    buffer.assign(s.data(), s.size());
+    return s.size();
 }
 
 bool Value::IsString(Runtime& rt) const {
-    return (bool) hexagon_ort_value_is_string(&res, rt._impl_handle());
+    return (bool) HX_ORT_FFI(hexagon_ort_value_is_string)(&res, rt._impl_handle());
 }
 
 ObjectHandle Value::ToObjectHandle(Runtime& rt) const {
     ObjectHandle ret;
-    ret.res = hexagon_ort_value_to_object_handle(&res, rt._impl_handle());
+    ret.res = HX_ORT_FFI(hexagon_ort_value_to_object_handle)(&res, rt._impl_handle());
     if(ret.res == nullptr) {
         throw std::runtime_error("Cannot convert to object handle");
     }
     return ret;
 }
 
-ProxiedObject * ObjectHandle::ToProxiedObject() {
-    HxOrtObjectProxy proxy = hexagon_ort_object_handle_to_object_proxy(res);
+BorrowedObjectHandle Value::BorrowObjectHandle(Runtime& rt) const {
+    HxOrtObjectHandle h = HX_ORT_FFI(hexagon_ort_value_to_object_handle)(&res, rt._impl_handle());
+    if(h == nullptr) {
+        throw std::runtime_error("Cannot convert to object handle");
+    }
+    return BorrowedObjectHandle(h);
+}
+
+template<class T> T * Value::As(Runtime& rt) const {
+    if(Type() != ValueType::Object) {
+        return nullptr;
+    }
+    return BorrowObjectHandle(rt).template As<T>();
+}
+
+template<class T> T * ObjectHandleView::As() noexcept {
+    static_assert(std::is_base_of<ProxiedObject, T>::value, "T must derive from ProxiedObject");
+
+    HxOrtObjectProxy proxy = HX_ORT_FFI(hexagon_ort_object_handle_to_object_proxy)(res);
+    if(proxy == nullptr) {
+        return nullptr;
+    }
+    ProxiedObject *obj = (ProxiedObject *) HX_ORT_FFI(hexagon_ort_object_proxy_get_data)(proxy);
+    if(obj == nullptr || obj -> GetTypeTag() != detail::type_tag_of<T>()) {
+        return nullptr;
+    }
+    return static_cast<T *>(obj);
+}
+
+ProxiedObject * ObjectHandleView::ToProxiedObject() {
+    HxOrtObjectProxy proxy = HX_ORT_FFI(hexagon_ort_object_handle_to_object_proxy)(res);
     if(proxy == nullptr) {
         throw std::runtime_error("Not an object proxy");
     }
-    ProxiedObject *obj = (ProxiedObject *) hexagon_ort_object_proxy_get_data(proxy);
+    ProxiedObject *obj = (ProxiedObject *) HX_ORT_FFI(hexagon_ort_object_proxy_get_data)(proxy);
     return obj;
 }
 
-std::string ObjectHandle::DumpVirtualFunction() {
-    HxOrtFunction f = hexagon_ort_object_handle_to_function(res);
+std::string ObjectHandleView::DumpVirtualFunction() {
+    HxOrtFunction f = HX_ORT_FFI(hexagon_ort_object_handle_to_function)(res);
     if(f == nullptr) {
         throw std::runtime_error("Not a function");
     }
-    char *code = hexagon_ort_function_dump_json(f);
+    char *code = HX_ORT_FFI(hexagon_ort_function_dump_json)(f);
     if(code == nullptr) {
         throw std::runtime_error("The function is not a printable virtual function. Try dump it before any optimizations.");
     }
     std::string ret = code;
-    hexagon_glue_destroy_cstring(code);
+    HX_ORT_FFI(hexagon_glue_destroy_cstring)(code);
     return ret;
 }
 
-void ObjectHandle::DebugPrintVirtualFunction() {
-    HxOrtFunction f = hexagon_ort_object_handle_to_function(res);
+void ObjectHandleView::DebugPrintVirtualFunction() {
+    HxOrtFunction f = HX_ORT_FFI(hexagon_ort_object_handle_to_function)(res);
     if(f == nullptr) {
         throw std::runtime_error("Not a function");
     }
-    hexagon_ort_function_debug_print(f);
+    HX_ORT_FFI(hexagon_ort_function_debug_print)(f);
 }
 
 } // namespace ort
@@ -0,0 +1,236 @@
+#pragma once
+
+// Allocation accounting for tests and benchmarks.
+//
+// Replaces the global operator new/delete and, on glibc, interposes
+// malloc/calloc/realloc/free so that allocations made by the backend are
+// counted too. Include it in exactly one translation unit of a test
+// binary; never from library code.
+//
+// Counts are kept per thread (for exact assertions that are not disturbed
+// by worker threads) and process-wide (for benchmarks).
+
+#include <cstddef>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define HX_ALLOC_COUNT_SANITIZED 1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define HX_ALLOC_COUNT_SANITIZED 1
+#endif
+
+// Sanitizers bring their own malloc, which must not be replaced.
+#if defined(__GLIBC__) && !defined(HX_ALLOC_COUNT_SANITIZED)
+#define HX_ALLOC_COUNT_MALLOC 1
+extern "C" {
+    void * __libc_malloc(size_t size);
+    void * __libc_calloc(size_t n, size_t size);
+    void * __libc_realloc(void *p, size_t size);
+    void __libc_free(void *p);
+}
+#endif
+
+namespace hexagon {
+namespace alloc_count {
+
+struct Counts {
+    // Global operator new / delete.
+    unsigned long long news = 0;
+    unsigned long long deletes = 0;
+
+    // Direct malloc family calls, including the backend's. Zero when
+    // malloc could not be interposed.
+    unsigned long long mallocs = 0;
+    unsigned long long frees = 0;
+
+    unsigned long long Allocs() const {
+        return news + mallocs;
+    }
+};
+
+namespace detail {
+    // Plain thread-locals with constant initialization, so they are safe
+    // to touch from inside malloc.
+    inline thread_local Counts thread_counts;
+    inline std::atomic<unsigned long long> total_allocs { 0 };
+
+    inline void * raw_malloc(size_t size) {
+#ifdef HX_ALLOC_COUNT_MALLOC
+        return __libc_malloc(size);
+#else
+        return std::malloc(size);
+#endif
+    }
+
+    inline void raw_free(void *p) {
+#ifdef HX_ALLOC_COUNT_MALLOC
+        __libc_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    inline void * counted_new(size_t size) {
+        thread_counts.news++;
+        total_allocs.fetch_add(1, std::memory_order_relaxed);
+        void *p = raw_malloc(size ? size : 1);
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    inline void * counted_new_aligned(size_t size, size_t align) {
+        thread_counts.news++;
+        total_allocs.fetch_add(1, std::memory_order_relaxed);
+        void *p = nullptr;
+        if(align < sizeof(void *)) {
+            align = sizeof(void *);
+        }
+        // posix_memalign is not interposed, so this is not counted twice.
+        if(posix_memalign(&p, align, size ? size : 1) != 0) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    inline void counted_delete(void *p) {
+        if(p) {
+            thread_counts.deletes++;
+            raw_free(p);
+        }
+    }
+} // namespace detail
+
+// This thread's counts so far.
+inline Counts Current() {
+    return detail::thread_counts;
+}
+
+// Allocations (operator new plus malloc) on all threads so far.
+inline unsigned long long TotalAllocs() {
+    return detail::total_allocs.load(std::memory_order_relaxed);
+}
+
+// Counts this thread's allocations from construction to Delta().
+class Scope {
+private:
+    Counts start;
+
+public:
+    Scope() : start(Current()) {}
+
+    Counts Delta() const {
+        Counts now = Current();
+        Counts ret;
+        ret.news = now.news - start.news;
+        ret.deletes = now.deletes - start.deletes;
+        ret.mallocs = now.mallocs - start.mallocs;
+        ret.frees = now.frees - start.frees;
+        return ret;
+    }
+};
+
+} // namespace alloc_count
+} // namespace hexagon
+
+void * operator new(size_t size) {
+    return hexagon::alloc_count::detail::counted_new(size);
+}
+
+void * operator new[](size_t size) {
+    return hexagon::alloc_count::detail::counted_new(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return hexagon::alloc_count::detail::counted_new(size);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void * operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return hexagon::alloc_count::detail::counted_new(size);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void * operator new(size_t size, std::align_val_t align) {
+    return hexagon::alloc_count::detail::counted_new_aligned(size, (size_t) align);
+}
+
+void * operator new[](size_t size, std::align_val_t align) {
+    return hexagon::alloc_count::detail::counted_new_aligned(size, (size_t) align);
+}
+
+void operator delete(void *p) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete[](void *p) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete(void *p, std::align_val_t align) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete[](void *p, std::align_val_t align) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete(void *p, size_t size, std::align_val_t align) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+void operator delete[](void *p, size_t size, std::align_val_t align) noexcept {
+    hexagon::alloc_count::detail::counted_delete(p);
+}
+
+#ifdef HX_ALLOC_COUNT_MALLOC
+extern "C" {
+    void * malloc(size_t size) {
+        hexagon::alloc_count::detail::thread_counts.mallocs++;
+        hexagon::alloc_count::detail::total_allocs.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void * calloc(size_t n, size_t size) {
+        hexagon::alloc_count::detail::thread_counts.mallocs++;
+        hexagon::alloc_count::detail::total_allocs.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(n, size);
+    }
+
+    // Counted as an allocation only when it acts as malloc.
+    void * realloc(void *p, size_t size) {
+        if(!p) {
+            hexagon::alloc_count::detail::thread_counts.mallocs++;
+            hexagon::alloc_count::detail::total_allocs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return __libc_realloc(p, size);
+    }
+
+    void free(void *p) {
+        if(p) {
+            hexagon::alloc_count::detail::thread_counts.frees++;
+        }
+        __libc_free(p);
+    }
+}
+#endif
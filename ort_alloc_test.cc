@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <functional>
+#include "ort.h"
+#include "ort_assembly_writer.h"
+#include "ort_alloc_count.h"
+
+using namespace hexagon;
+
+// Exact operator new counts for the wrapper hot paths. A change that adds
+// an allocation to one of these paths fails here; if it is intended,
+// update the expected count in the same change.
+//
+// Backend (malloc) allocations depend on the backend build, so they are
+// checked against a per-op ceiling rather than exactly. The ceilings are
+// loose; they catch per-call churn creeping in, not a single extra
+// allocation. Without malloc interposition they are not checked.
+
+class Adder : public ort::TypedProxiedObject<Adder> {
+public:
+    using ort::ProxiedObject::Call;
+
+    virtual ort::Value Call(ort::ArgSpan args) {
+        return ort::Value::FromInt(args.at(0).ExtractI64() + args.at(1).ExtractI64());
+    }
+};
+
+class Point : public ort::FieldDispatchedObject<Point> {
+public:
+    static void DeclareFields(ort::FieldTable<Point>& fields) {
+        fields.Field("x", &Point::GetX);
+    }
+
+    ort::Value GetX() {
+        return ort::Value::FromInt(1);
+    }
+};
+
+static int n_failures = 0;
+
+// Runs `op` once to warm up caches, then `n` more times, and checks that
+// each run made exactly `expected` operator new calls and at most
+// `max_mallocs` malloc family calls.
+void expect_allocs(const char *name, unsigned long long expected, unsigned long long max_mallocs, const std::function<void ()>& op) {
+    const int n = 100;
+
+    op();
+
+    alloc_count::Scope scope;
+    for(int i = 0; i < n; i++) {
+        op();
+    }
+    alloc_count::Counts delta = scope.Delta();
+
+    bool ok = delta.news == expected * n;
+#ifdef HX_ALLOC_COUNT_MALLOC
+    ok = ok && delta.mallocs <= max_mallocs * n;
+#endif
+    printf("%s %s: %.2f news / op (expected %llu), %.2f mallocs / op (at most %llu)\n",
+        ok ? "ok  " : "FAIL",
+        name,
+        (double) delta.news / n,
+        expected,
+        (double) delta.mallocs / n,
+        max_mallocs
+    );
+    if(!ok) {
+        n_failures++;
+    }
+}
+
+void test_value_creation(ort::Runtime& rt) {
+    expect_allocs("value_from_int", 0, 0, [&]() {
+        ort::Value::FromInt(42);
+    });
+    expect_allocs("value_from_float", 0, 0, [&]() {
+        ort::Value::FromFloat(1.5);
+    });
+    expect_allocs("value_from_bool", 0, 0, [&]() {
+        ort::Value::FromBool(true);
+    });
+    expect_allocs("value_from_string", 0, 2, [&]() {
+        ort::Value::FromString("Hello world", rt);
+    });
+}
+
+void test_string_round_trip(ort::Runtime& rt) {
+    expect_allocs("string_round_trip", 0, 3, [&]() {
+        ort::Value v = ort::Value::FromString("Hello world", rt);
+        std::string s = v.ToString(rt);
+    });
+    ort::Value long_string = ort::Value::FromString(std::string(256, 'x'), rt);
+    expect_allocs("string_to_string_long", 1, 2, [&]() {
+        std::string s = long_string.ToString(rt);
+    });
+}
+
+void test_load_native() {
+    expect_allocs("load_native_typed", 0, 2, [&]() {
+        ort::Function f = ort::Function::LoadNative<long long (long long)>([](long long x) {
+            return x;
+        });
+    });
+    // The std::function is copied to the heap for the backend to own.
+    expect_allocs("load_native_std_function", 1, 2, [&]() {
+        ort::Function f = ort::Function::LoadNative([]() {
+            return ort::Value::Null();
+        });
+    });
+}
+
+void test_invoke(ort::Runtime& rt) {
+    ort::Function f = ort::Function::LoadNative<long long (long long, long long)>([](long long a, long long b) {
+        return a + b;
+    });
+    rt.AttachFunction("add", f);
+    ort::Value add = rt.GetStaticObject("add");
+    ort::StaticSlot add_slot = rt.ResolveStatic("add");
+
+    expect_allocs("invoke_native", 0, 4, [&]() {
+        rt.Invoke(add, ort::Value::FromInt(1), ort::Value::FromInt(2));
+    });
+    expect_allocs("invoke_static_slot", 0, 4, [&]() {
+        rt.Invoke(add_slot, ort::Value::FromInt(1), ort::Value::FromInt(2));
+    });
+
+    std::vector<ort::Value> args = { ort::Value::FromInt(1), ort::Value::FromInt(2) };
+    expect_allocs("invoke_vector", 0, 4, [&]() {
+        rt.Invoke(add, args);
+    });
+}
+
+void test_proxy(ort::Runtime& rt) {
+    ort::ObjectProxy adder_proxy(new Adder());
+    ort::Value adder = adder_proxy.Pin(rt);
+
+    expect_allocs("proxy_call", 0, 4, [&]() {
+        rt.Invoke(adder, ort::Value::FromInt(1), ort::Value::FromInt(2));
+    });
+
+    Point *point = new Point();
+    ort::ObjectProxy point_proxy(point);
+    ort::Value point_value = point_proxy.Pin(rt);
+
+    // The C++ half of a field get: what the on_get_field trampoline runs.
+    expect_allocs("proxy_get_field_direct", 0, 0, [&]() {
+        ort::Value ret = ort::Value(HxOrtValue());
+        if(point -> TryGetField("x", ret) != ort::Status::Ok) {
+            throw std::runtime_error("Field get failed");
+        }
+    });
+
+    // The whole path: bytecode doing GetField on the pinned object.
+    assembly_writer::FunctionWriter fwriter;
+    fwriter.NewBlock()
+        .LoadString("x")
+        .GetArgument(0)
+        .GetField()
+        .Return();
+    ort::Function get_x_fn = fwriter.Build();
+    rt.AttachFunction("get_x", get_x_fn);
+    ort::Value get_x = rt.GetStaticObject("get_x");
+
+    ort::Value x = rt.Invoke(get_x, point_value);
+    if(x.Type() != ort::ValueType::Int || x.ExtractI64() != 1) {
+        printf("FAIL proxy_get_field: bytecode GetField returned the wrong value\n");
+        n_failures++;
+    }
+    expect_allocs("proxy_get_field", 0, 8, [&]() {
+        rt.Invoke(get_x, point_value);
+    });
+
+    ort::Value s = ort::Value::FromString("Hello world", rt);
+    expect_allocs("object_handle", 0, 1, [&]() {
+        ort::ObjectHandle handle = s.ToObjectHandle(rt);
+    });
+    expect_allocs("object_handle_borrowed", 0, 1, [&]() {
+        ort::BorrowedObjectHandle handle = s.BorrowObjectHandle(rt);
+    });
+}
+
+int main() {
+    ort::Runtime rt;
+
+    test_value_creation(rt);
+    test_string_round_trip(rt);
+    test_load_native();
+    test_invoke(rt);
+    test_proxy(rt);
+
+    if(n_failures) {
+        printf("%d allocation checks failed\n", n_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -3,27 +3,126 @@
 #include <string>
 #include <stdexcept>
 #include <vector>
-#include <sstream>
-#include <iomanip>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <deque>
+#include <memory_resource>
+#include <optional>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include "ort.h"
+#include "ort_serialization.h"
 
 namespace hexagon {
 namespace assembly_writer {
+	// Owns the operand strings and custom opcode names of a FunctionWriter
+	// (or of a block built on its own). Each distinct string is stored
+	// once, in memory taken from the writer's resource, and stays put
+	// until Release() or destruction. Not thread-safe, like the writer.
+	class StringPool {
+	private:
+		std::pmr::memory_resource *upstream;
+		std::optional<std::pmr::monotonic_buffer_resource> chars;
+		std::optional<std::pmr::unordered_set<std::string_view>> index;
+
+	public:
+		explicit StringPool(std::pmr::memory_resource *_upstream = std::pmr::get_default_resource())
+			: upstream(_upstream) {}
+
+		StringPool(const StringPool& other) = delete;
+
+		std::string_view Intern(std::string_view s) {
+			if(s.empty()) {
+				return std::string_view("", 0);
+			}
+			if(!index) {
+				chars.emplace(upstream);
+				index.emplace(&*chars);
+			}
+
+			auto it = index -> find(s);
+			if(it != index -> end()) {
+				return *it;
+			}
+			char *data = (char *) chars -> allocate(s.size(), 1);
+			memcpy(data, s.data(), s.size());
+			std::string_view ret(data, s.size());
+			index -> insert(ret);
+			return ret;
+		}
+
+		// Returns all memory to the upstream resource. Invalidates every
+		// string handed out so far.
+		void Release() {
+			index.reset();
+			chars.reset();
+		}
+	};
+
 	// we skip the `usize` case here because the serializer
 	// doesn't care.
-	enum class OperandType {
+	enum class OperandType : unsigned char {
 		i64_,
 		f64_,
 		string_,
 		bool_,
 	};
+
+	// Tagged union, 16 bytes.
+	//
+	// Operand::String copies the string, so an operand built from a
+	// temporary stays valid. String literals, and strings passed to
+	// Operand::BorrowString, are borrowed instead: they must outlive the
+	// operand. Writing an operand into a block copies its string into the
+	// block's StringPool either way.
 	struct Operand {
 		OperandType type;
 
-		long long i64_value;
-		double f64_value;
-		std::string string_value;
-		bool bool_value;
+		// Set when `string_data` was allocated by this operand.
+		bool string_owned;
+
+		unsigned int string_len;
+
+		union {
+			long long i64_value;
+			double f64_value;
+			const char *string_data;
+			bool bool_value;
+		};
+
+		Operand() : type(OperandType::i64_), string_owned(false), string_len(0), i64_value(0) {}
+
+		Operand(const Operand& other) : Operand() {
+			copy_from(other);
+		}
+
+		Operand(Operand&& other) noexcept : Operand() {
+			take_from(other);
+		}
+
+		Operand& operator=(const Operand& other) {
+			if(this != &other) {
+				release();
+				copy_from(other);
+			}
+			return *this;
+		}
+
+		Operand& operator=(Operand&& other) noexcept {
+			if(this != &other) {
+				release();
+				take_from(other);
+			}
+			return *this;
+		}
+
+		~Operand() {
+			release();
+		}
 
 		static Operand I64(long long i) {
 			Operand v;
@@ -39,10 +138,33 @@ namespace assembly_writer {
 			return v;
 		}
 
-		static Operand String(const std::string& i) {
+		static Operand String(std::string_view i) {
+			Operand v = BorrowString(i);
+			v.own_string();
+			return v;
+		}
+
+		// String literals are borrowed; they live for the whole program.
+		template<size_t N>
+		static Operand String(const char (&i)[N]) {
+			return BorrowString(std::string_view(i));
+		}
+
+		// Non-const arrays are usually stack buffers, so they are copied.
+		template<size_t N>
+		static Operand String(char (&i)[N]) {
+			return String(std::string_view(i));
+		}
+
+		// Does not copy `i`, which has to stay alive as long as the operand.
+		static Operand BorrowString(std::string_view i) {
+			if(i.size() > UINT32_MAX) {
+				throw std::length_error("String operand too long");
+			}
 			Operand v;
 			v.type = OperandType::string_;
-			v.string_value = i;
+			v.string_len = (unsigned int) i.size();
+			v.string_data = i.data();
 			return v;
 		}
 
@@ -53,223 +175,1200 @@ namespace assembly_writer {
 			return v;
 		}
 
-		long long GetI64() {
+		long long GetI64() const {
 			if(type != OperandType::i64_) {
 				throw std::runtime_error("Type mismatch");
 			}
 			return i64_value;
 		}
 
-		double GetF64() {
+		double GetF64() const {
 			if(type != OperandType::f64_) {
 				throw std::runtime_error("Type mismatch");
 			}
 			return f64_value;
 		}
 
-		std::string& GetString() {
+		std::string_view GetString() const {
 			if(type != OperandType::string_) {
 				throw std::runtime_error("Type mismatch");
 			}
-			return string_value;
+			return std::string_view(string_data, string_len);
 		}
 
-		bool GetBool() {
+		bool GetBool() const {
 			if(type != OperandType::bool_) {
 				throw std::runtime_error("Type mismatch");
 			}
 			return bool_value;
 		}
+
+	private:
+		void own_string() {
+			char *data = new char[string_len > 0 ? string_len : 1];
+			memcpy(data, string_data, string_len);
+			string_data = data;
+			string_owned = true;
+		}
+
+		void copy_from(const Operand& other) {
+			type = other.type;
+			string_len = other.string_len;
+			i64_value = other.i64_value;
+			if(other.string_owned) {
+				string_data = other.string_data;
+				own_string();
+			}
+		}
+
+		void take_from(Operand& other) {
+			type = other.type;
+			string_len = other.string_len;
+			i64_value = other.i64_value;
+			string_owned = other.string_owned;
+			other.string_owned = false;
+		}
+
+		void release() {
+			if(string_owned) {
+				delete[] string_data;
+				string_owned = false;
+			}
+		}
+	};
+
+	static_assert(sizeof(Operand) == 16, "Operand should stay 16 bytes");
+
+	// Inline storage for the (at most two) operands of an op.
+	class OperandList {
+	private:
+		Operand items[2];
+		unsigned char count = 0;
+
+	public:
+		void push_back(const Operand& v) {
+			if(count == 2) {
+				throw std::length_error("An opcode takes at most two operands");
+			}
+			items[count++] = v;
+		}
+
+		void push_back(Operand&& v) {
+			if(count == 2) {
+				throw std::length_error("An opcode takes at most two operands");
+			}
+			items[count++] = std::move(v);
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		const Operand& operator[](size_t i) const {
+			return items[i];
+		}
+
+		Operand& operator[](size_t i) {
+			return items[i];
+		}
+
+		const Operand * begin() const {
+			return items;
+		}
+
+		const Operand * end() const {
+			return items + count;
+		}
+
+		Operand * begin() {
+			return items;
+		}
+
+		Operand * end() {
+			return items + count;
+		}
+	};
+
+	// Opcode table: each entry is the opcode name followed by the types of
+	// its operands. Index operands (`usize` in the VM) are written as i64.
+	// Binary bytecode stores ops by their Opcode value, so new opcodes go
+	// at the end and existing entries never move.
+	#define HX_ORT_OPCODES(OP0, OP1, OP2) \
+		OP0(Nop) \
+		OP0(LoadNull) \
+		OP1(LoadInt, i64_) \
+		OP1(LoadFloat, f64_) \
+		OP1(LoadString, string_) \
+		OP1(LoadBool, bool_) \
+		OP0(LoadThis) \
+		OP1(Call, i64_) \
+		OP1(CallField, i64_) \
+		OP0(Pop) \
+		OP0(Dup) \
+		OP1(InitLocal, i64_) \
+		OP1(GetLocal, i64_) \
+		OP1(SetLocal, i64_) \
+		OP1(GetArgument, i64_) \
+		OP0(GetNArguments) \
+		OP0(GetStatic) \
+		OP0(SetStatic) \
+		OP0(GetField) \
+		OP0(SetField) \
+		OP1(Branch, i64_) \
+		OP2(ConditionalBranch, i64_, i64_) \
+		OP0(Return) \
+		OP0(Add) \
+		OP0(Sub) \
+		OP0(Mul) \
+		OP0(Div) \
+		OP0(Mod) \
+		OP0(Pow) \
+		OP0(IntAdd) \
+		OP0(IntSub) \
+		OP0(IntMul) \
+		OP0(IntDiv) \
+		OP0(IntMod) \
+		OP0(IntPow) \
+		OP0(FloatAdd) \
+		OP0(FloatSub) \
+		OP0(FloatMul) \
+		OP0(FloatDiv) \
+		OP0(FloatPowi) \
+		OP0(FloatPowf) \
+		OP0(StringAdd) \
+		OP0(CastToFloat) \
+		OP0(CastToInt) \
+		OP0(CastToBool) \
+		OP0(CastToString) \
+		OP0(And) \
+		OP0(Or) \
+		OP0(Not) \
+		OP0(TestLt) \
+		OP0(TestLe) \
+		OP0(TestEq) \
+		OP0(TestNe) \
+		OP0(TestGe) \
+		OP0(TestGt) \
+		OP0(Rotate2) \
+		OP0(Rotate3) \
+		OP1(RotateReverse, i64_)
+
+	#define HX_ORT_OPCODE_ENUM_0(name) name,
+	#define HX_ORT_OPCODE_ENUM_1(name, a) name,
+	#define HX_ORT_OPCODE_ENUM_2(name, a, b) name,
+
+	enum class Opcode : unsigned char {
+		HX_ORT_OPCODES(HX_ORT_OPCODE_ENUM_0, HX_ORT_OPCODE_ENUM_1, HX_ORT_OPCODE_ENUM_2)
+		// Not in the table; the op carries its own name.
+		Custom
+	};
+
+	#undef HX_ORT_OPCODE_ENUM_0
+	#undef HX_ORT_OPCODE_ENUM_1
+	#undef HX_ORT_OPCODE_ENUM_2
+
+	struct OpcodeInfo {
+		const char *name;
+		unsigned int name_len;
+		unsigned int arity;
+		OperandType operand_types[2];
+	};
+
+	#define HX_ORT_OPCODE_INFO_0(name) { #name, sizeof(#name) - 1, 0, { OperandType::i64_, OperandType::i64_ } },
+	#define HX_ORT_OPCODE_INFO_1(name, a) { #name, sizeof(#name) - 1, 1, { OperandType::a, OperandType::i64_ } },
+	#define HX_ORT_OPCODE_INFO_2(name, a, b) { #name, sizeof(#name) - 1, 2, { OperandType::a, OperandType::b } },
+
+	static constexpr OpcodeInfo opcode_table[] = {
+		HX_ORT_OPCODES(HX_ORT_OPCODE_INFO_0, HX_ORT_OPCODE_INFO_1, HX_ORT_OPCODE_INFO_2)
+	};
+
+	#undef HX_ORT_OPCODE_INFO_0
+	#undef HX_ORT_OPCODE_INFO_1
+	#undef HX_ORT_OPCODE_INFO_2
+
+	static_assert(
+		sizeof(opcode_table) / sizeof(opcode_table[0]) == (size_t) Opcode::Custom,
+		"Opcode table out of sync with Opcode"
+	);
+
+	static constexpr const OpcodeInfo& GetOpcodeInfo(Opcode op) {
+		return opcode_table[(size_t) op];
+	}
+
+	// Opcodes ordered by name, built at compile time for LookupOpcode.
+	struct OpcodeNameIndex {
+		unsigned char sorted[(size_t) Opcode::Custom];
+
+		static constexpr std::string_view name_of(size_t i) {
+			return std::string_view(opcode_table[i].name, opcode_table[i].name_len);
+		}
+
+		constexpr OpcodeNameIndex() : sorted() {
+			for(size_t i = 0; i < (size_t) Opcode::Custom; i++) {
+				size_t j = i;
+				while(j > 0 && name_of(i) < name_of(sorted[j - 1])) {
+					sorted[j] = sorted[j - 1];
+					j--;
+				}
+				sorted[j] = (unsigned char) i;
+			}
+		}
+
+		constexpr Opcode Find(std::string_view name) const {
+			size_t lo = 0;
+			size_t hi = (size_t) Opcode::Custom;
+			while(lo < hi) {
+				size_t mid = (lo + hi) / 2;
+				std::string_view candidate = name_of(sorted[mid]);
+				if(candidate == name) {
+					return (Opcode) sorted[mid];
+				}
+				if(candidate < name) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			return Opcode::Custom;
+		}
 	};
 
+	static constexpr OpcodeNameIndex opcode_name_index;
+
+	// Returns Opcode::Custom for names that are not in the table.
+	static constexpr Opcode LookupOpcode(std::string_view name) {
+		return opcode_name_index.Find(name);
+	}
+
+	static constexpr bool opcode_lookup_round_trips() {
+		for(size_t i = 0; i < (size_t) Opcode::Custom; i++) {
+			if(LookupOpcode(OpcodeNameIndex::name_of(i)) != (Opcode) i) {
+				return false;
+			}
+		}
+		return LookupOpcode("NoSuchOp") == Opcode::Custom && LookupOpcode("") == Opcode::Custom;
+	}
+
+	static_assert(opcode_lookup_round_trips(), "Opcode names must be unique and found by LookupOpcode");
+
+	// 56 bytes; fits in one cache line. Table opcodes store no name.
+	// Custom names are copied like string operands, and the copy is
+	// replaced by a pooled one when the op is written into a block.
 	struct BytecodeOp {
-		std::string name;
-		std::vector<Operand> operands;
+		Opcode opcode;
+
+		// Set when `custom_name` was allocated by this op.
+		bool custom_name_owned = false;
+
+		// Only set for Opcode::Custom. Use Name() to read the name.
+		unsigned int custom_name_len = 0;
+		const char *custom_name = nullptr;
+		OperandList operands;
+
+		BytecodeOp(Opcode _opcode) {
+			opcode = _opcode;
+		}
+
+		BytecodeOp(const BytecodeOp& other)
+			: opcode(other.opcode), custom_name_len(other.custom_name_len), custom_name(other.custom_name), operands(other.operands) {
+			if(other.custom_name_owned) {
+				own_name();
+			}
+		}
+
+		BytecodeOp(BytecodeOp&& other) noexcept
+			: opcode(other.opcode), custom_name_owned(other.custom_name_owned), custom_name_len(other.custom_name_len),
+			  custom_name(other.custom_name), operands(std::move(other.operands)) {
+			other.custom_name_owned = false;
+		}
+
+		BytecodeOp& operator=(const BytecodeOp& other) {
+			if(this != &other) {
+				BytecodeOp copy(other);
+				*this = std::move(copy);
+			}
+			return *this;
+		}
+
+		BytecodeOp& operator=(BytecodeOp&& other) noexcept {
+			if(this != &other) {
+				release_name();
+				opcode = other.opcode;
+				custom_name_owned = other.custom_name_owned;
+				custom_name_len = other.custom_name_len;
+				custom_name = other.custom_name;
+				operands = std::move(other.operands);
+				other.custom_name_owned = false;
+			}
+			return *this;
+		}
+
+		~BytecodeOp() {
+			release_name();
+		}
+
+		BytecodeOp(
+			Opcode _opcode,
+			const Operand& arg1
+		) {
+			opcode = _opcode;
+			operands.push_back(arg1);
+		}
 
-		BytecodeOp(const std::string& _name) {
-			name = _name;
+		BytecodeOp(
+			Opcode _opcode,
+			const Operand& arg1,
+			const Operand& arg2
+		) {
+			opcode = _opcode;
+			operands.push_back(arg1);
+			operands.push_back(arg2);
+		}
+
+		BytecodeOp(std::string_view _name) {
+			set_name(_name);
 		}
 
 		BytecodeOp(
-			const std::string& _name,
+			std::string_view _name,
 			const Operand& arg1
 		) {
-			name = _name;
+			set_name(_name);
 			operands.push_back(arg1);
 		}
 
 		BytecodeOp(
-			const std::string& _name,
+			std::string_view _name,
 			const Operand& arg1,
 			const Operand& arg2
 		) {
-			name = _name;
+			set_name(_name);
 			operands.push_back(arg1);
 			operands.push_back(arg2);
 		}
+
+		std::string_view Name() const {
+			if(opcode == Opcode::Custom) {
+				return std::string_view(custom_name, custom_name_len);
+			}
+			const OpcodeInfo& info = GetOpcodeInfo(opcode);
+			return std::string_view(info.name, info.name_len);
+		}
+
+		// Replaces the opcode, looking `_name` up like the constructors do.
+		// Custom names are copied.
+		void SetName(std::string_view _name) {
+			// `_name` may point into this op's own name.
+			BytecodeOp renamed(_name);
+			release_name();
+			opcode = renamed.opcode;
+			custom_name_owned = renamed.custom_name_owned;
+			custom_name_len = renamed.custom_name_len;
+			custom_name = renamed.custom_name;
+			renamed.custom_name_owned = false;
+		}
+
+		// Returns a copy whose custom name and string operands point into
+		// `pool`. Allocates nothing outside the pool.
+		BytecodeOp InternedIn(StringPool& pool) const {
+			BytecodeOp ret(opcode);
+			if(opcode == Opcode::Custom) {
+				std::string_view name = pool.Intern(Name());
+				ret.custom_name = name.data();
+				ret.custom_name_len = custom_name_len;
+			}
+			for(const Operand& operand : operands) {
+				if(operand.type == OperandType::string_) {
+					ret.operands.push_back(Operand::BorrowString(pool.Intern(operand.GetString())));
+				} else {
+					ret.operands.push_back(operand);
+				}
+			}
+			return ret;
+		}
+
+	private:
+		void set_name(std::string_view _name) {
+			opcode = LookupOpcode(_name);
+			if(opcode == Opcode::Custom) {
+				if(_name.size() > UINT32_MAX) {
+					throw std::length_error("Opcode name too long");
+				}
+				custom_name = _name.data();
+				custom_name_len = (unsigned int) _name.size();
+				own_name();
+			}
+		}
+
+		void own_name() {
+			char *data = new char[custom_name_len > 0 ? custom_name_len : 1];
+			memcpy(data, custom_name, custom_name_len);
+			custom_name = data;
+			custom_name_owned = true;
+		}
+
+		void release_name() {
+			if(custom_name_owned) {
+				delete[] custom_name;
+				custom_name_owned = false;
+			}
+		}
 	};
 
+	static_assert(sizeof(BytecodeOp) <= 64, "BytecodeOp should fit in a cache line");
+
+	#define HX_ORT_OPERAND_ARG_i64_ long long
+	#define HX_ORT_OPERAND_ARG_f64_ double
+	#define HX_ORT_OPERAND_ARG_string_ std::string_view
+	#define HX_ORT_OPERAND_ARG_bool_ bool
+
+	#define HX_ORT_OPERAND_MAKE_i64_ Operand::I64
+	#define HX_ORT_OPERAND_MAKE_f64_ Operand::F64
+	#define HX_ORT_OPERAND_MAKE_string_ Operand::BorrowString
+	#define HX_ORT_OPERAND_MAKE_bool_ Operand::Bool
+
+	// Argument types each operand kind accepts in the typed writers. The
+	// writers would otherwise take anything that converts implicitly, so
+	// `GetLocal(1.5)`, `GetLocal(true)` and `LoadBool(5)` would compile.
+	// Index operands take any integer type so literals like `GetLocal(2)`
+	// keep working.
+	template<class A>
+	struct AcceptsOperand_i64_ : std::bool_constant<
+		std::is_integral<std::decay_t<A>>::value && !std::is_same<std::decay_t<A>, bool>::value
+	> {};
+	template<class A>
+	struct AcceptsOperand_f64_ : std::is_floating_point<std::decay_t<A>> {};
+	template<class A>
+	struct AcceptsOperand_string_ : std::bool_constant<
+		std::is_convertible<A, std::string_view>::value
+			&& !std::is_arithmetic<std::decay_t<A>>::value
+			&& !std::is_null_pointer<std::decay_t<A>>::value
+	> {};
+	template<class A>
+	struct AcceptsOperand_bool_ : std::is_same<std::decay_t<A>, bool> {};
+
+	// Each typed writer has an lvalue and an rvalue form, so chains that
+	// start from a temporary stay rvalues and can be moved into a
+	// FunctionWriter. The rvalue form returns the block by value (a cheap
+	// move), so binding a chain with `auto&&` does not dangle.
+	// The deleted templates are exact matches for any argument type the
+	// operand does not accept, so those calls fail to compile instead of
+	// converting.
+	#define HX_ORT_OPCODE_WRITER_0(name) \
+		BasicBlockWriter& name() & { \
+			return Write(BytecodeOp(Opcode::name)); \
+		} \
+		BasicBlockWriter name() && { \
+			return std::move(Write(BytecodeOp(Opcode::name))); \
+		}
+	#define HX_ORT_OPCODE_WRITER_1(name, a) \
+		BasicBlockWriter& name(HX_ORT_OPERAND_ARG_##a arg1) & { \
+			return Write(BytecodeOp(Opcode::name, HX_ORT_OPERAND_MAKE_##a(arg1))); \
+		} \
+		BasicBlockWriter name(HX_ORT_OPERAND_ARG_##a arg1) && { \
+			return std::move(Write(BytecodeOp(Opcode::name, HX_ORT_OPERAND_MAKE_##a(arg1)))); \
+		} \
+		template<class A1, std::enable_if_t<!AcceptsOperand_##a<A1>::value, int> = 0> \
+		BasicBlockWriter& name(A1&& arg1) & = delete; \
+		template<class A1, std::enable_if_t<!AcceptsOperand_##a<A1>::value, int> = 0> \
+		BasicBlockWriter name(A1&& arg1) && = delete;
+	#define HX_ORT_OPCODE_WRITER_2(name, a, b) \
+		BasicBlockWriter& name(HX_ORT_OPERAND_ARG_##a arg1, HX_ORT_OPERAND_ARG_##b arg2) & { \
+			return Write(BytecodeOp(Opcode::name, HX_ORT_OPERAND_MAKE_##a(arg1), HX_ORT_OPERAND_MAKE_##b(arg2))); \
+		} \
+		BasicBlockWriter name(HX_ORT_OPERAND_ARG_##a arg1, HX_ORT_OPERAND_ARG_##b arg2) && { \
+			return std::move(Write(BytecodeOp(Opcode::name, HX_ORT_OPERAND_MAKE_##a(arg1), HX_ORT_OPERAND_MAKE_##b(arg2)))); \
+		} \
+		template<class A1, class A2, std::enable_if_t<!(AcceptsOperand_##a<A1>::value && AcceptsOperand_##b<A2>::value), int> = 0> \
+		BasicBlockWriter& name(A1&& arg1, A2&& arg2) & = delete; \
+		template<class A1, class A2, std::enable_if_t<!(AcceptsOperand_##a<A1>::value && AcceptsOperand_##b<A2>::value), int> = 0> \
+		BasicBlockWriter name(A1&& arg1, A2&& arg2) && = delete;
+
+	class FunctionWriter;
+
 	class BasicBlockWriter {
+	private:
+		// Position in the owning FunctionWriter, assigned when the block
+		// is added to one.
+		size_t id = (size_t) -1;
+
+		// Where written ops keep their strings: the owning writer's pool,
+		// or `own_pool` for a block built on its own.
+		StringPool *pool = nullptr;
+		std::unique_ptr<StringPool> own_pool;
+
+		StringPool& strings() {
+			if(!pool) {
+				own_pool.reset(new StringPool(opcodes.get_allocator().resource()));
+				pool = own_pool.get();
+			}
+			return *pool;
+		}
+
+		// Makes sure this block's strings live as long as the writer that
+		// owns `target`. A block built on its own hands its pool over to
+		// `keep` as is; only a block taken from another writer, whose pool
+		// it does not own, has its strings copied into `target`.
+		void adopt_pool(StringPool& target, std::vector<std::unique_ptr<StringPool>>& keep) {
+			if(pool == &target) {
+				return;
+			}
+			if(own_pool) {
+				keep.push_back(std::move(own_pool));
+				return;
+			}
+			if(pool) {
+				for(BytecodeOp& op : opcodes) {
+					op = op.InternedIn(target);
+				}
+			}
+			pool = &target;
+		}
+
 	public:
-		std::vector<BytecodeOp> opcodes;
+		// Allocator-aware, so blocks created inside a FunctionWriter
+		// allocate from the writer's memory resource.
+		typedef std::pmr::polymorphic_allocator<BytecodeOp> allocator_type;
+
+		std::pmr::vector<BytecodeOp> opcodes;
 
 		BasicBlockWriter() = default;
+		explicit BasicBlockWriter(const allocator_type& alloc) : opcodes(alloc) {}
 		BasicBlockWriter(const BasicBlockWriter& other) = delete;
 		BasicBlockWriter(BasicBlockWriter&& other) = default;
+		BasicBlockWriter(BasicBlockWriter&& other, const allocator_type& alloc)
+			: id(other.id), pool(other.pool), own_pool(std::move(other.own_pool)), opcodes(std::move(other.opcodes), alloc) {}
+		BasicBlockWriter& operator=(BasicBlockWriter&& other) = default;
+
+		BasicBlockWriter& Write(const BytecodeOp& op) & {
+			opcodes.push_back(op.InternedIn(strings()));
+			return *this;
+		}
+
+		BasicBlockWriter Write(const BytecodeOp& op) && {
+			opcodes.push_back(op.InternedIn(strings()));
+			return std::move(*this);
+		}
 
-		BasicBlockWriter& Write(const BytecodeOp& op) {
-            opcodes.push_back(op);
-            return *this;
+		// Index of this block in its FunctionWriter, for use as a branch target.
+		size_t Id() const {
+			if(id == (size_t) -1) {
+				throw std::logic_error("Block is not owned by a FunctionWriter");
+			}
+			return id;
 		}
 
+		// Typed writers, one per opcode: `bb.GetLocal(2)`,
+		// `bb.ConditionalBranch(2, 3)`. Operand count and types are
+		// checked by the compiler.
+		HX_ORT_OPCODES(HX_ORT_OPCODE_WRITER_0, HX_ORT_OPCODE_WRITER_1, HX_ORT_OPCODE_WRITER_2)
+
 		void Clear() {
 			opcodes.clear();
 		}
 
-		BasicBlockWriter Clone() const {
-			BasicBlockWriter ret;
-			ret.opcodes = opcodes;
+		BasicBlockWriter Clone(const allocator_type& alloc = allocator_type()) const {
+			BasicBlockWriter ret(alloc);
+			ret.opcodes.reserve(opcodes.size());
+			for(const BytecodeOp& op : opcodes) {
+				ret.Write(op);
+			}
 			return ret;
 		}
+
+		friend class FunctionWriter;
 	};
 
-	class FunctionWriter {
+	// Blocks live in a deque so references returned by
+	// FunctionWriter::NewBlock() stay valid as more blocks are added.
+	typedef std::pmr::deque<BasicBlockWriter> BasicBlockList;
+
+	#undef HX_ORT_OPCODE_WRITER_0
+	#undef HX_ORT_OPCODE_WRITER_1
+	#undef HX_ORT_OPCODE_WRITER_2
+	#undef HX_ORT_OPERAND_ARG_i64_
+	#undef HX_ORT_OPERAND_ARG_f64_
+	#undef HX_ORT_OPERAND_ARG_string_
+	#undef HX_ORT_OPERAND_ARG_bool_
+	#undef HX_ORT_OPERAND_MAKE_i64_
+	#undef HX_ORT_OPERAND_MAKE_f64_
+	#undef HX_ORT_OPERAND_MAKE_string_
+	#undef HX_ORT_OPERAND_MAKE_bool_
+
+	using serialization::CountingSink;
+	using serialization::PointerSink;
+	using serialization::StringSink;
+	using serialization::CallbackSink;
+	using serialization::FdSink;
+
+	// Bump allocator for FunctionWriter. Deallocation is a no-op and
+	// Reset() rewinds to the start of the buffer. Allocations that do not
+	// fit go to the global heap, and the next Reset() grows the buffer to
+	// cover them, so a loop that builds similarly sized functions settles
+	// into doing no global allocations at all. The buffer never shrinks on
+	// its own: it ends up as large as the biggest round built since the
+	// last shrink. Long-lived arenas that see the occasional huge function
+	// can pass a limit to Reset() to give that memory back. Not
+	// thread-safe; use one arena per thread.
+	class WriterArena : public std::pmr::memory_resource {
 	private:
-        std::vector<BasicBlockWriter> basic_blocks;
-        std::function<void (std::vector<BasicBlockWriter>&)> user_translator;
-
-		// https://stackoverflow.com/questions/7724448/simple-json-string-escape-for-c/33799784#33799784
-		static std::string escape_json(const std::string& s) {
-			std::ostringstream o;
-			for (auto c = s.cbegin(); c != s.cend(); c++) {
-				if (*c == '"' || *c == '\\' || ('\x00' <= *c && *c <= '\x1f')) {
-					o << "\\u"
-					  << std::hex << std::setw(4) << std::setfill('0') << (int)*c;
-				} else {
-					o << *c;
-				}
+		struct OverflowChunk {
+			OverflowChunk *next;
+		};
+
+		std::unique_ptr<char[]> buffer;
+		size_t capacity;
+		char *cursor;
+		OverflowChunk *overflow = nullptr;
+		size_t overflow_bytes = 0;
+
+		static char * align_up(char *p, size_t align) {
+			return (char *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+		}
+
+	protected:
+		void * do_allocate(size_t bytes, size_t align) override {
+			// Compared as sizes: forming a pointer past the end of the
+			// buffer, even just to compare it, is undefined.
+			size_t left = capacity - (size_t) (cursor - buffer.get());
+			size_t pad = (align - (size_t) ((uintptr_t) cursor & (align - 1))) & (align - 1);
+			if(pad <= left && bytes <= left - pad) {
+				char *start = cursor + pad;
+				cursor = start + bytes;
+				return start;
+			}
+
+			size_t total = sizeof(OverflowChunk) + align + bytes;
+			OverflowChunk *chunk = (OverflowChunk *) ::operator new(total);
+			chunk -> next = overflow;
+			overflow = chunk;
+			overflow_bytes += total;
+			return align_up((char *) (chunk + 1), align);
+		}
+
+		void do_deallocate(void *, size_t, size_t) override {}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+			return this == &other;
+		}
+
+	public:
+		WriterArena(size_t initial_capacity = 64 * 1024)
+			: buffer(new char[initial_capacity]), capacity(initial_capacity) {
+			cursor = buffer.get();
+		}
+
+		WriterArena(const WriterArena& other) = delete;
+
+		~WriterArena() {
+			release_overflow();
+		}
+
+		// Invalidates everything allocated from the arena. The buffer grows
+		// to cover the last round's overflow, but never past
+		// `capacity_limit`; a buffer already larger than that is shrunk.
+		void Reset(size_t capacity_limit = SIZE_MAX) {
+			release_overflow();
+			size_t wanted = capacity + overflow_bytes;
+			if(wanted > capacity_limit) {
+				wanted = capacity_limit;
+			}
+			if(wanted != capacity) {
+				buffer.reset(new char[wanted]);
+				capacity = wanted;
 			}
-			return o.str();
+			overflow_bytes = 0;
+			cursor = buffer.get();
 		}
 
-		static std::string operand_to_string(const Operand& operand) {
-			std::ostringstream o;
-			
+		size_t Capacity() const {
+			return capacity;
+		}
+
+		size_t Used() const {
+			return cursor - buffer.get();
+		}
+
+	private:
+		void release_overflow() {
+			while(overflow) {
+				OverflowChunk *next = overflow -> next;
+				::operator delete(overflow);
+				overflow = next;
+			}
+		}
+	};
+
+	class FunctionWriter {
+	private:
+		std::pmr::memory_resource *resource;
+		WriterArena *arena = nullptr;
+		// Declared before the blocks, which point into it.
+		std::unique_ptr<StringPool> strings;
+		// Pools of blocks built on their own and then written in.
+		std::vector<std::unique_ptr<StringPool>> adopted_pools;
+        std::optional<BasicBlockList> basic_blocks;
+        std::function<void (BasicBlockList&)> user_translator;
+		// Translator taking the block list as a std::vector, as before
+		// blocks moved into a BasicBlockList.
+		std::function<void (std::vector<BasicBlockWriter>&)> vector_translator;
+		std::string code_buffer;
+
+		template<class Sink>
+		static void write_escaped(Sink& sink, std::string_view s) {
+			serialization::WriteJsonEscaped(sink, s.data(), s.size());
+		}
+
+		template<class Sink>
+		static void write_operand(Sink& sink, const Operand& operand) {
 			switch(operand.type) {
 				case OperandType::i64_:
-					o << operand.i64_value;
+					serialization::WriteJsonI64(sink, operand.i64_value);
 					break;
 				case OperandType::f64_:
-					o << operand.f64_value;
+					serialization::WriteJsonF64(sink, operand.f64_value);
 					break;
 				case OperandType::string_:
-					o << "\"" << escape_json(operand.string_value) << "\"";
+					sink.Append('"');
+					write_escaped(sink, operand.GetString());
+					sink.Append('"');
 					break;
 				case OperandType::bool_:
-					o << (operand.bool_value ? "true" : "false");
+					serialization::WriteJsonBool(sink, operand.bool_value);
 					break;
 				default:
 					throw 0;
 			}
-
-			return o.str();
 		}
 
     public:
         FunctionWriter() {
+            resource = std::pmr::get_default_resource();
+            strings.reset(new StringPool(resource));
+            basic_blocks.emplace(resource);
             user_translator = nullptr;
         }
 
-        FunctionWriter(const std::function<void (std::vector<BasicBlockWriter>&)>& ut) {
+        FunctionWriter(const std::function<void (BasicBlockList&)>& ut) {
+            resource = std::pmr::get_default_resource();
+            strings.reset(new StringPool(resource));
+            basic_blocks.emplace(resource);
             user_translator = ut;
         }
 
+		// Translators written against a std::vector block list still work.
+		// Build() moves the blocks into a vector for the call and back out
+		// afterwards. Only the block headers move: ops and strings stay
+		// where they are, but it is still two moves per block on every
+		// Build; take a BasicBlockList& to avoid that.
+		FunctionWriter(const std::function<void (std::vector<BasicBlockWriter>&)>& ut) {
+			resource = std::pmr::get_default_resource();
+			strings.reset(new StringPool(resource));
+			basic_blocks.emplace(resource);
+			vector_translator = ut;
+		}
+
+		// Blocks, ops and serialization scratch space are allocated from
+		// `_resource`, which must outlive the writer.
+		FunctionWriter(
+			std::pmr::memory_resource *_resource,
+			const std::function<void (BasicBlockList&)>& ut = nullptr
+		) {
+			resource = _resource;
+			strings.reset(new StringPool(resource));
+			basic_blocks.emplace(resource);
+			user_translator = ut;
+		}
+
+		// Like the memory_resource constructor, but Reset() also rewinds
+		// the arena.
+		FunctionWriter(
+			WriterArena& _arena,
+			const std::function<void (BasicBlockList&)>& ut = nullptr
+		) {
+			resource = &_arena;
+			arena = &_arena;
+			strings.reset(new StringPool(resource));
+			basic_blocks.emplace(resource);
+			user_translator = ut;
+		}
+
+		// Drops all blocks and strings so the writer can build another
+		// function. The output buffer keeps its capacity; an arena is
+		// rewound and capped at `arena_capacity_limit` (see
+		// WriterArena::Reset).
+		void Reset(size_t arena_capacity_limit = SIZE_MAX) {
+			basic_blocks.reset();
+			adopted_pools.clear();
+			strings -> Release();
+			if(arena) {
+				arena -> Reset(arena_capacity_limit);
+			}
+			basic_blocks.emplace(resource);
+		}
+
+		// Copies `bb`. Prefer NewBlock() or passing an rvalue.
 		FunctionWriter& Write(const BasicBlockWriter& bb) {
-            basic_blocks.push_back(bb.Clone());
-            return *this;
+            return Write(bb.Clone(BasicBlockWriter::allocator_type(resource)));
         }
+
+		// Moves `bb` in without copying its ops or strings. `bb` must use
+		// the writer's memory resource: moving between resources would
+		// copy every op, so it is rejected. Blocks made by NewBlock()
+		// always qualify, and a default-constructed block qualifies for a
+		// writer on the default resource.
+		FunctionWriter& Write(BasicBlockWriter&& bb) {
+			if(!bb.opcodes.get_allocator().resource() -> is_equal(*resource)) {
+				throw std::invalid_argument("Write: Block uses a different memory resource than the writer; build it with NewBlock()");
+			}
+			basic_blocks -> push_back(std::move(bb));
+			basic_blocks -> back().id = basic_blocks -> size() - 1;
+			basic_blocks -> back().adopt_pool(*strings, adopted_pools);
+			return *this;
+		}
+
+		// Constructs an empty block in place. The returned reference stays
+		// valid for the lifetime of the writer.
+		BasicBlockWriter& NewBlock() {
+			basic_blocks -> emplace_back();
+			basic_blocks -> back().id = basic_blocks -> size() - 1;
+			basic_blocks -> back().pool = strings.get();
+			return basic_blocks -> back();
+		}
+
+		BasicBlockWriter& Block(size_t id) {
+			return basic_blocks -> at(id);
+		}
+
+		size_t BlockCount() const {
+			return basic_blocks -> size();
+		}
         
         ort::Function Build() {
             if(user_translator != nullptr) {
-                user_translator(basic_blocks);
+                user_translator(*basic_blocks);
+            }
+            if(vector_translator != nullptr) {
+                std::vector<BasicBlockWriter> blocks;
+                blocks.reserve(basic_blocks -> size());
+                for(BasicBlockWriter& bb : *basic_blocks) {
+                    blocks.push_back(std::move(bb));
+                }
+                basic_blocks -> clear();
+                vector_translator(blocks);
+                for(BasicBlockWriter& bb : blocks) {
+                    Write(std::move(bb));
+                }
             }
 
-            std::string code = ToJson();
-
+            ToJson(code_buffer);
             return ort::Function::LoadVirtual(
                 "json",
-                (const unsigned char *) code.c_str(),
-                code.size()
+                (const unsigned char *) code_buffer.data(),
+                code_buffer.size()
             );
         }
 
-		std::string ToJson() {
-			std::string output;
-
-			output += "{\"basic_blocks\":";
-
-			output += "[";
+		// Serializes the function in one pass into any sink.
+		template<class Sink>
+		void WriteJson(Sink& sink) const {
+			sink.Append("{\"basic_blocks\":[", 17);
 
 			bool is_first_bb = true;
 
-			for (auto& bb : basic_blocks) {
+			for (auto& bb : *basic_blocks) {
 				if(is_first_bb) {
 					is_first_bb = false;
 				} else {
-					output += ",";
+					sink.Append(',');
 				}
 
-				output += "{\"opcodes\":";
+				sink.Append("{\"opcodes\":[", 12);
 
-				output += "[";
-				
 				bool is_first = true;
-	
+
 				for(auto& op : bb.opcodes) {
 					if(is_first) {
 						is_first = false;
 					} else {
-						output += ",";
+						sink.Append(',');
 					}
-	
+
 					if(op.operands.size() == 0) {
-						output += "\"";
-						output += escape_json(op.name);
-						output += "\"";
+						sink.Append('"');
+						write_escaped(sink, op.Name());
+						sink.Append('"');
 					} else {
-						output += "{\"";
-						output += escape_json(op.name);
-						output += "\":";
-	
+						sink.Append("{\"", 2);
+						write_escaped(sink, op.Name());
+						sink.Append("\":", 2);
+
 						if(op.operands.size() == 1) {
-							output += operand_to_string(op.operands[0]);
+							write_operand(sink, op.operands[0]);
 						} else {
-							output += "[";
-	
+							sink.Append('[');
+
 							bool inner_first = true;
 							for(auto& iop : op.operands) {
 								if(inner_first) {
 									inner_first = false;
 								} else {
-									output += ",";
+									sink.Append(',');
 								}
-	
-								output += operand_to_string(iop);
+
+								write_operand(sink, iop);
 							}
-	
-							output += "]";
+
+							sink.Append(']');
+						}
+
+						sink.Append('}');
+					}
+				}
+
+				sink.Append("]}", 2);
+			}
+
+			sink.Append("]}", 2);
+		}
+
+		// Exact length of the JSON output.
+		size_t JsonSize() const {
+			CountingSink counter;
+			WriteJson(counter);
+			return counter.size;
+		}
+
+		// Serializes into `output`, replacing its contents. The string is
+		// sized once up front, so a reused buffer never reallocates after
+		// it has grown to the largest function.
+		void ToJson(std::string& output) const {
+			output.resize(JsonSize());
+			if(output.size() > 0) {
+				PointerSink sink(&output[0]);
+				WriteJson(sink);
+			}
+		}
+
+		std::string ToJson() const {
+			std::string output;
+			ToJson(output);
+			return output;
+		}
+
+		// Serializes into the compact binary storage format:
+		//
+		//     magic      "HXB" 0x02
+		//     strings    varint count, then (varint len, bytes) per string
+		//     blocks     varint count, then per block:
+		//                    varint n_ops, then per op:
+		//                        varint opcode, varint n_operands,
+		//                        then per operand: tag byte + payload
+		//
+		// `opcode` is the Opcode value shifted left by one for table ops,
+		// and a string index shifted left by one with the low bit set for
+		// custom ops. The string pool holds string constants and custom
+		// opcode names, each distinct one written once. Operand payloads
+		// are described in ort_serialization.h.
+		//
+		// No backend loads this format. Use TranscodeBinaryToJson to get
+		// the JSON back before calling Function::LoadVirtual.
+		template<class Sink>
+		void WriteBinary(Sink& sink) const {
+			std::pmr::unordered_map<std::string_view, unsigned long long> string_ids(resource);
+			std::pmr::vector<std::string_view> strings_table(resource);
+
+			auto intern = [&](std::string_view s) {
+				auto it = string_ids.find(s);
+				if(it != string_ids.end()) {
+					return it -> second;
+				}
+				unsigned long long id = strings_table.size();
+				string_ids.emplace(s, id);
+				strings_table.push_back(s);
+				return id;
+			};
+
+			for(auto& bb : *basic_blocks) {
+				for(auto& op : bb.opcodes) {
+					if(op.opcode == Opcode::Custom) {
+						intern(op.Name());
+					}
+					for(auto& operand : op.operands) {
+						if(operand.type == OperandType::string_) {
+							intern(operand.GetString());
 						}
-	
-						output += "}";
 					}
 				}
-	
-				output += "]}";
 			}
 
-			output += "]}";
+			sink.Append(serialization::BinaryMagic, sizeof(serialization::BinaryMagic));
+
+			serialization::WriteVarint(sink, strings_table.size());
+			for(auto& s : strings_table) {
+				serialization::WriteVarint(sink, s.size());
+				sink.Append(s.data(), s.size());
+			}
+
+			serialization::WriteVarint(sink, basic_blocks -> size());
+			for(auto& bb : *basic_blocks) {
+				serialization::WriteVarint(sink, bb.opcodes.size());
+				for(auto& op : bb.opcodes) {
+					if(op.opcode == Opcode::Custom) {
+						serialization::WriteVarint(sink, string_ids[op.Name()] << 1 | 1);
+					} else {
+						serialization::WriteVarint(sink, (unsigned long long) op.opcode << 1);
+					}
+					serialization::WriteVarint(sink, op.operands.size());
+					for(auto& operand : op.operands) {
+						switch(operand.type) {
+							case OperandType::i64_:
+								sink.Append((char) serialization::BinaryTag::I64);
+								serialization::WriteZigzag(sink, operand.i64_value);
+								break;
+							case OperandType::f64_:
+								sink.Append((char) serialization::BinaryTag::F64);
+								serialization::WriteF64LE(sink, operand.f64_value);
+								break;
+							case OperandType::string_:
+								sink.Append((char) serialization::BinaryTag::String);
+								serialization::WriteVarint(sink, string_ids[operand.GetString()]);
+								break;
+							case OperandType::bool_:
+								sink.Append((char) (operand.bool_value ? serialization::BinaryTag::BoolTrue : serialization::BinaryTag::BoolFalse));
+								break;
+							default:
+								throw 0;
+						}
+					}
+				}
+			}
+		}
+
+		void ToBinary(std::string& output) const {
+			output.clear();
+			StringSink sink(output);
+			WriteBinary(sink);
+		}
+
+		std::string ToBinary() const {
+			std::string output;
+			ToBinary(output);
 			return output;
 		}
     };
+
+	// Converts binary bytecode from FunctionWriter::WriteBinary back into
+	// the JSON encoding, producing the same bytes FunctionWriter::ToJson
+	// would for the same function. This is how stored binary bytecode is
+	// loaded: transcode, then Function::LoadVirtual("json", ...).
+	template<class Sink>
+	void TranscodeBinaryToJson(const unsigned char *code, size_t len, Sink& sink) {
+		serialization::BinaryReader reader(code, len);
+
+		if(memcmp(reader.ReadBytes(sizeof(serialization::BinaryMagic)), serialization::BinaryMagic, sizeof(serialization::BinaryMagic)) != 0) {
+			throw std::runtime_error("Bad binary bytecode magic");
+		}
+
+		std::vector<std::pair<const char *, size_t>> strings;
+		reader.ReadStringTable(strings);
+
+		auto string_at = [&](unsigned long long id) -> const std::pair<const char *, size_t>& {
+			if(id >= strings.size()) {
+				throw std::runtime_error("String index out of bound");
+			}
+			return strings[id];
+		};
+
+		auto write_operand = [&]() {
+			switch((serialization::BinaryTag) reader.ReadByte()) {
+				case serialization::BinaryTag::I64:
+					serialization::WriteJsonI64(sink, reader.ReadZigzag());
+					break;
+				case serialization::BinaryTag::F64:
+					serialization::WriteJsonF64(sink, reader.ReadF64LE());
+					break;
+				case serialization::BinaryTag::String: {
+					const std::pair<const char *, size_t>& s = string_at(reader.ReadVarint());
+					sink.Append('"');
+					serialization::WriteJsonEscaped(sink, s.first, s.second);
+					sink.Append('"');
+					break;
+				}
+				case serialization::BinaryTag::BoolFalse:
+					serialization::WriteJsonBool(sink, false);
+					break;
+				case serialization::BinaryTag::BoolTrue:
+					serialization::WriteJsonBool(sink, true);
+					break;
+				default:
+					throw std::runtime_error("Unknown operand tag");
+			}
+		};
+
+		sink.Append("{\"basic_blocks\":[", 17);
+
+		unsigned long long n_blocks = reader.ReadVarint();
+		for(unsigned long long i = 0; i < n_blocks; i++) {
+			if(i > 0) {
+				sink.Append(',');
+			}
+			sink.Append("{\"opcodes\":[", 12);
+
+			unsigned long long n_ops = reader.ReadVarint();
+			for(unsigned long long j = 0; j < n_ops; j++) {
+				if(j > 0) {
+					sink.Append(',');
+				}
+
+				unsigned long long op_id = reader.ReadVarint();
+				std::string_view name;
+				if(op_id & 1) {
+					const std::pair<const char *, size_t>& s = string_at(op_id >> 1);
+					name = std::string_view(s.first, s.second);
+				} else {
+					if((op_id >> 1) >= (unsigned long long) Opcode::Custom) {
+						throw std::runtime_error("Opcode index out of bound");
+					}
+					const OpcodeInfo& info = GetOpcodeInfo((Opcode) (op_id >> 1));
+					name = std::string_view(info.name, info.name_len);
+				}
+				unsigned long long n_operands = reader.ReadVarint();
+
+				if(n_operands == 0) {
+					sink.Append('"');
+					serialization::WriteJsonEscaped(sink, name.data(), name.size());
+					sink.Append('"');
+				} else {
+					sink.Append("{\"", 2);
+					serialization::WriteJsonEscaped(sink, name.data(), name.size());
+					sink.Append("\":", 2);
+
+					if(n_operands == 1) {
+						write_operand();
+					} else {
+						sink.Append('[');
+						for(unsigned long long k = 0; k < n_operands; k++) {
+							if(k > 0) {
+								sink.Append(',');
+							}
+							write_operand();
+						}
+						sink.Append(']');
+					}
+
+					sink.Append('}');
+				}
+			}
+
+			sink.Append("]}", 2);
+		}
+
+		sink.Append("]}", 2);
+
+		if(!reader.AtEnd()) {
+			throw std::runtime_error("Trailing data after binary bytecode");
+		}
+	}
 } // namespace assembly_writer
 } // namespace hexagon
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "ort_serialization.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HX_BENCH_HAS_TSC 1
+#endif
+
+namespace hexagon {
+namespace benchmark {
+
+// Hardware cycle and instruction counters for the calling thread, from
+// perf_event_open. Available() is false when the kernel refuses (common
+// in containers); callers then just omit the numbers.
+class PerfCounters {
+private:
+    int group_fd = -1;
+    int instructions_fd = -1;
+
+#ifdef __linux__
+    static int open_counter(unsigned long long config, int group) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+    }
+#endif
+
+public:
+    PerfCounters() {
+#ifdef __linux__
+        group_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if(group_fd >= 0) {
+            instructions_fd = open_counter(PERF_COUNT_HW_INSTRUCTIONS, group_fd);
+            if(instructions_fd < 0) {
+                close(group_fd);
+                group_fd = -1;
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters& other) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+        if(instructions_fd >= 0) close(instructions_fd);
+        if(group_fd >= 0) close(group_fd);
+#endif
+    }
+
+    bool Available() const {
+        return group_fd >= 0;
+    }
+
+    void Start() {
+#ifdef __linux__
+        if(!Available()) return;
+        ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // Stops counting and returns false if the counters could not be read.
+    bool Stop(unsigned long long& cycles, unsigned long long& instructions) {
+#ifdef __linux__
+        if(!Available()) return false;
+        ioctl(group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        unsigned long long buf[3];
+        if(read(group_fd, buf, sizeof(buf)) != (ssize_t) sizeof(buf) || buf[0] != 2) {
+            return false;
+        }
+        cycles = buf[1];
+        instructions = buf[2];
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+// One benchmark's numbers. Per-iteration values that were not measured
+// are NaN and are left out of the JSON output.
+//
+// min, median and batch_p99 are taken over per-batch averages (see
+// BenchSuite::Run), not over individual operations, so batch_p99_ns of a
+// benchmark with rare slow operations is much lower than its per-operation
+// p99, which is p99_ns.
+struct BenchResult {
+    std::string name;
+    unsigned long long iterations = 0;
+    double min_ns = NAN;
+    double median_ns = NAN;
+    double batch_p99_ns = NAN;
+    double p99_ns = NAN;
+    double tsc = NAN;
+    double cycles = NAN;
+    double instructions = NAN;
+    double allocs = NAN;
+};
+
+// Runs benchmarks and collects their results.
+//
+// The callback runs `n` iterations of the measured operation. Run() splits
+// the requested iteration count into up to `max_samples` equal batches,
+// runs one untimed warmup batch, then times each batch on its own, so
+// min/median/batch p99 are over per-batch averages. The per-operation p99
+// comes from up to `max_op_samples` single-operation calls made afterwards
+// (or from the batches themselves when each holds one operation); it
+// includes the cost of reading the clock, so it overstates very cheap
+// operations.
+class BenchSuite {
+public:
+    typedef std::function<void (int n)> Callback;
+
+    int max_samples = 100;
+    int max_op_samples = 1000;
+
+    // Optional. Returns a running allocation count, used for allocs/iter.
+    std::function<unsigned long long ()> alloc_counter;
+
+private:
+    std::vector<BenchResult> results;
+    PerfCounters perf;
+
+    // Parser for the JSON written by WriteJson: objects, arrays, strings
+    // and numbers only. Anything else is an error rather than being
+    // skipped, so a damaged baseline cannot quietly compare as empty.
+    class BaselineParser {
+    private:
+        const char *cursor;
+        const char *end;
+
+        [[noreturn]] void malformed(const char *what) const {
+            throw std::runtime_error(std::string("Malformed benchmark baseline: ") + what);
+        }
+
+        void skip_space() {
+            while(cursor != end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t')) {
+                cursor++;
+            }
+        }
+
+        bool consume(char c) {
+            skip_space();
+            if(cursor != end && *cursor == c) {
+                cursor++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c, const char *what) {
+            if(!consume(c)) {
+                malformed(what);
+            }
+        }
+
+        int hex_digit(char c) const {
+            if(c >= '0' && c <= '9') return c - '0';
+            if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+            malformed("bad \\u escape");
+        }
+
+        std::string parse_string() {
+            expect('"', "expected a string");
+            std::string ret;
+            while(true) {
+                if(cursor == end) {
+                    malformed("unterminated string");
+                }
+                char c = *cursor++;
+                if(c == '"') {
+                    return ret;
+                }
+                if((unsigned char) c < 0x20) {
+                    malformed("control character in string");
+                }
+                if(c != '\\') {
+                    ret.push_back(c);
+                    continue;
+                }
+                if(cursor == end) {
+                    malformed("unterminated string");
+                }
+                c = *cursor++;
+                switch(c) {
+                    case '"': case '\\': case '/': ret.push_back(c); break;
+                    case 'b': ret.push_back('\b'); break;
+                    case 'f': ret.push_back('\f'); break;
+                    case 'n': ret.push_back('\n'); break;
+                    case 'r': ret.push_back('\r'); break;
+                    case 't': ret.push_back('\t'); break;
+                    case 'u': {
+                        // Names are byte strings; WriteJson only escapes
+                        // single bytes.
+                        if(end - cursor < 4) {
+                            malformed("bad \\u escape");
+                        }
+                        int v = 0;
+                        for(int i = 0; i < 4; i++) {
+                            v = v * 16 + hex_digit(cursor[i]);
+                        }
+                        if(v > 0xff) {
+                            malformed("\\u escape outside a single byte");
+                        }
+                        ret.push_back((char) v);
+                        cursor += 4;
+                        break;
+                    }
+                    default:
+                        malformed("bad escape");
+                }
+            }
+        }
+
+        double parse_number() {
+            skip_space();
+            const char *start = cursor;
+            if(cursor != end && *cursor == '-') {
+                cursor++;
+            }
+            if(cursor == end || *cursor < '0' || *cursor > '9') {
+                malformed("expected a number");
+            }
+            while(cursor != end && ((*cursor >= '0' && *cursor <= '9') || *cursor == '.' || *cursor == 'e' || *cursor == 'E' || *cursor == '+' || *cursor == '-')) {
+                cursor++;
+            }
+            std::string text(start, cursor);
+            char *parsed_end;
+            double v = strtod(text.c_str(), &parsed_end);
+            if(parsed_end != text.c_str() + text.size()) {
+                malformed("bad number");
+            }
+            return v;
+        }
+
+        BenchResult parse_result() {
+            BenchResult r;
+            bool has_name = false;
+            expect('{', "expected a result object");
+            if(!consume('}')) {
+                do {
+                    std::string key = parse_string();
+                    expect(':', "expected ':'");
+                    if(key == "name") {
+                        r.name = parse_string();
+                        has_name = true;
+                        continue;
+                    }
+                    double v = parse_number();
+                    if(key == "iterations") r.iterations = (unsigned long long) v;
+                    else if(key == "min_ns") r.min_ns = v;
+                    else if(key == "median_ns") r.median_ns = v;
+                    else if(key == "batch_p99_ns") r.batch_p99_ns = v;
+                    else if(key == "p99_ns") r.p99_ns = v;
+                    else if(key == "tsc") r.tsc = v;
+                    else if(key == "cycles") r.cycles = v;
+                    else if(key == "instructions") r.instructions = v;
+                    else if(key == "allocs") r.allocs = v;
+                } while(consume(','));
+                expect('}', "expected ',' or '}'");
+            }
+            if(!has_name) {
+                malformed("result without a name");
+            }
+            if(std::isnan(r.median_ns)) {
+                malformed("result without median_ns");
+            }
+            return r;
+        }
+
+    public:
+        BaselineParser(const std::string& text) : cursor(text.data()), end(text.data() + text.size()) {}
+
+        std::vector<BenchResult> Parse() {
+            std::vector<BenchResult> ret;
+            expect('{', "expected '{'");
+            if(parse_string() != "benchmarks") {
+                malformed("expected \"benchmarks\"");
+            }
+            expect(':', "expected ':'");
+            expect('[', "expected '['");
+            if(!consume(']')) {
+                do {
+                    ret.push_back(parse_result());
+                } while(consume(','));
+                expect(']', "expected ',' or ']'");
+            }
+            expect('}', "expected '}'");
+            skip_space();
+            if(cursor != end) {
+                malformed("trailing data");
+            }
+            return ret;
+        }
+    };
+
+    static double percentile(const std::vector<double>& sorted, double q) {
+        return sorted[std::min(sorted.size() - 1, (size_t) std::ceil(sorted.size() * q) - 1)];
+    }
+
+    template<class Sink>
+    static void write_field(Sink& sink, const char *key, double v) {
+        if(std::isnan(v)) {
+            return;
+        }
+        sink.Append(",\"", 2);
+        sink.Append(key, strlen(key));
+        sink.Append("\":", 2);
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%.3f", v);
+        sink.Append(buf, len);
+    }
+
+    // Results are matched by name, so a repeated name would silently be
+    // compared against the wrong run.
+    static void check_unique_names(const std::vector<BenchResult>& list) {
+        for(size_t i = 0; i < list.size(); i++) {
+            for(size_t j = 0; j < i; j++) {
+                if(list[i].name == list[j].name) {
+                    throw std::logic_error("Duplicate benchmark name: " + list[i].name);
+                }
+            }
+        }
+    }
+
+public:
+    const BenchResult& Run(const char *name, const Callback& cb, int n) {
+        if(n < 1) {
+            n = 1;
+        }
+        int n_samples = std::min(n, max_samples);
+        int batch = n / n_samples;
+
+        printf("Bench: %s\n", name);
+
+        cb(batch);
+
+        std::vector<double> samples;
+        samples.reserve(n_samples);
+        unsigned long long allocs_before = alloc_counter ? alloc_counter() : 0;
+#ifdef HX_BENCH_HAS_TSC
+        unsigned long long tsc_total = 0;
+#endif
+        perf.Start();
+
+        for(int i = 0; i < n_samples; i++) {
+#ifdef HX_BENCH_HAS_TSC
+            unsigned long long tsc_start = __rdtsc();
+#endif
+            auto start_time = std::chrono::steady_clock::now();
+            cb(batch);
+            auto end_time = std::chrono::steady_clock::now();
+#ifdef HX_BENCH_HAS_TSC
+            tsc_total += __rdtsc() - tsc_start;
+#endif
+            samples.push_back(std::chrono::duration<double, std::nano>(end_time - start_time).count() / batch);
+        }
+
+        BenchResult r;
+        r.name = name;
+        r.iterations = (unsigned long long) n_samples * batch;
+
+        unsigned long long cycles, instructions;
+        if(perf.Stop(cycles, instructions)) {
+            r.cycles = (double) cycles / r.iterations;
+            r.instructions = (double) instructions / r.iterations;
+        }
+#ifdef HX_BENCH_HAS_TSC
+        r.tsc = (double) tsc_total / r.iterations;
+#endif
+        if(alloc_counter) {
+            r.allocs = (double) (alloc_counter() - allocs_before) / r.iterations;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        r.min_ns = samples.front();
+        r.median_ns = samples[samples.size() / 2];
+        r.batch_p99_ns = percentile(samples, 0.99);
+
+        // Timed after the counters are read so they stay per-batch. At most
+        // as many single calls as the batches made, so this at worst
+        // doubles the run time.
+        if(batch == 1) {
+            r.p99_ns = r.batch_p99_ns;
+        } else if(max_op_samples > 0) {
+            int n_ops = (int) std::min(r.iterations, (unsigned long long) max_op_samples);
+            std::vector<double> op_samples;
+            op_samples.reserve(n_ops);
+            for(int i = 0; i < n_ops; i++) {
+                auto start_time = std::chrono::steady_clock::now();
+                cb(1);
+                auto end_time = std::chrono::steady_clock::now();
+                op_samples.push_back(std::chrono::duration<double, std::nano>(end_time - start_time).count());
+            }
+            std::sort(op_samples.begin(), op_samples.end());
+            r.p99_ns = percentile(op_samples, 0.99);
+        }
+
+        printf("Done. %.1f ns / iter (min %.1f, p99 %.1f, batch p99 %.1f)", r.median_ns, r.min_ns, r.p99_ns, r.batch_p99_ns);
+        if(!std::isnan(r.cycles)) {
+            printf(", %.1f cycles, %.1f instructions", r.cycles, r.instructions);
+        }
+        if(!std::isnan(r.allocs)) {
+            printf(", %.2f allocs", r.allocs);
+        }
+        printf("\n");
+
+        results.push_back(r);
+        return results.back();
+    }
+
+    const std::vector<BenchResult>& Results() const {
+        return results;
+    }
+
+    // One result object per line, so baselines diff readably.
+    void WriteJson(const char *path) const {
+        check_unique_names(results);
+
+        std::string out;
+        serialization::StringSink sink(out);
+
+        sink.Append("{\"benchmarks\":[\n", 16);
+        for(size_t i = 0; i < results.size(); i++) {
+            const BenchResult& r = results[i];
+            sink.Append("{\"name\":\"", 9);
+            serialization::WriteJsonEscaped(sink, r.name.data(), r.name.size());
+            sink.Append("\",\"iterations\":", 15);
+            serialization::WriteJsonI64(sink, (long long) r.iterations);
+            write_field(sink, "min_ns", r.min_ns);
+            write_field(sink, "median_ns", r.median_ns);
+            write_field(sink, "batch_p99_ns", r.batch_p99_ns);
+            write_field(sink, "p99_ns", r.p99_ns);
+            write_field(sink, "tsc", r.tsc);
+            write_field(sink, "cycles", r.cycles);
+            write_field(sink, "instructions", r.instructions);
+            write_field(sink, "allocs", r.allocs);
+            sink.Append(i + 1 < results.size() ? "},\n" : "}\n", i + 1 < results.size() ? 3 : 2);
+        }
+        sink.Append("]}\n", 3);
+
+        FILE *f = fopen(path, "wb");
+        if(!f) {
+            throw std::runtime_error("Unable to open benchmark output file");
+        }
+        fwrite(out.data(), 1, out.size(), f);
+        fclose(f);
+    }
+
+    // Reads a file written by WriteJson. Throws if the file is not
+    // exactly that format or a result lacks its name or median.
+    static std::vector<BenchResult> ReadJson(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if(!f) {
+            throw std::runtime_error("Unable to open benchmark baseline");
+        }
+
+        std::string text;
+        char buf[4096];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            text.append(buf, n);
+        }
+        bool failed = ferror(f) != 0;
+        fclose(f);
+        if(failed) {
+            throw std::runtime_error("Unable to read benchmark baseline");
+        }
+
+        return BaselineParser(text).Parse();
+    }
+
+    // Prints every benchmark whose median is more than `threshold` (0.1 =
+    // 10%) slower than in `baseline`. Returns the number of regressions.
+    size_t Compare(const std::vector<BenchResult>& baseline, double threshold) const {
+        check_unique_names(results);
+        check_unique_names(baseline);
+
+        size_t n_regressions = 0;
+
+        for(const BenchResult& r : results) {
+            auto it = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult& b) {
+                return b.name == r.name;
+            });
+            if(it == baseline.end() || !(it -> median_ns > 0)) {
+                continue;
+            }
+
+            double change = r.median_ns / it -> median_ns - 1.0;
+            bool regressed = change > threshold;
+            if(regressed) {
+                n_regressions++;
+            }
+            printf("%s %s: %.1f -> %.1f ns (%+.1f%%)\n",
+                regressed ? "REGRESSION" : "ok        ",
+                r.name.c_str(),
+                it -> median_ns,
+                r.median_ns,
+                change * 100.0
+            );
+        }
+
+        return n_regressions;
+    }
+};
+
+} // namespace benchmark
+} // namespace hexagon
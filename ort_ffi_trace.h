@@ -0,0 +1,184 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Counting of C ABI calls made by the wrappers in ort.h.
+//
+// Every `hexagon_*` call in ort.h is written as `HX_ORT_FFI(hexagon_xxx)(...)`.
+// Normally that is just the function name. With HX_ORT_TRACE_FFI defined,
+// each call site gets a static counter that records the entry point and the
+// wrapper method making the call, and FfiTrace reports the totals.
+//
+// This is meant for finding chatty wrappers (several ABI calls where one
+// would do) under real workloads, not for timing.
+
+namespace hexagon {
+namespace ort {
+
+#ifdef HX_ORT_TRACE_FFI
+namespace ffi_trace_detail {
+    // One per call site and template instantiation. Sites register
+    // themselves on first use and are never freed.
+    struct Site {
+        const char *entry;
+        const char *caller;
+        std::atomic<unsigned long long> calls { 0 };
+        Site *next;
+
+        static std::atomic<Site *>& Head() {
+            static std::atomic<Site *> head { nullptr };
+            return head;
+        }
+
+        Site(const char *_entry, const char *_caller) : entry(_entry), caller(_caller) {
+            std::atomic<Site *>& head = Head();
+            next = head.load(std::memory_order_relaxed);
+            while(!head.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed));
+        }
+    };
+
+    template<class F>
+    inline F hit(Site& site, F f) {
+        site.calls.fetch_add(1, std::memory_order_relaxed);
+        return f;
+    }
+
+    // "static hexagon::ort::Value hexagon::ort::Value::FromInt(T) [with T = int]"
+    // becomes "Value::FromInt". Template arguments in the return type or
+    // the class name may contain spaces and parentheses, so both scans
+    // skip over anything inside <>.
+    inline std::string short_caller(const char *pretty) {
+        const char *end = pretty + strlen(pretty);
+        const char *paren = end;
+        int depth = 0;
+        for(const char *p = pretty; p != end; p++) {
+            if(*p == '<') depth++;
+            else if(*p == '>' && depth > 0) depth--;
+            else if(*p == '(' && depth == 0) {
+                paren = p;
+                break;
+            }
+        }
+
+        const char *start = paren;
+        depth = 0;
+        while(start != pretty) {
+            char c = start[-1];
+            if(c == '>') depth++;
+            else if(c == '<' && depth > 0) depth--;
+            else if(c == ' ' && depth == 0) break;
+            start--;
+        }
+
+        std::string ret(start, paren);
+        static const char prefix[] = "hexagon::ort::";
+        if(ret.compare(0, sizeof(prefix) - 1, prefix) == 0) {
+            ret.erase(0, sizeof(prefix) - 1);
+        }
+        return ret;
+    }
+} // namespace ffi_trace_detail
+#endif
+
+struct FfiTraceEntry {
+    std::string entry;
+    std::string caller;
+    unsigned long long calls;
+};
+
+class FfiTrace {
+public:
+    // Call counts per (entry point, wrapper method), with template
+    // instantiations of the same method merged. Sorted by count. Empty
+    // unless HX_ORT_TRACE_FFI is defined.
+    static std::vector<FfiTraceEntry> Report() {
+        std::vector<FfiTraceEntry> ret;
+#ifdef HX_ORT_TRACE_FFI
+        for(ffi_trace_detail::Site *s = ffi_trace_detail::Site::Head().load(std::memory_order_acquire); s; s = s -> next) {
+            unsigned long long calls = s -> calls.load(std::memory_order_relaxed);
+            if(calls == 0) {
+                continue;
+            }
+            std::string caller = ffi_trace_detail::short_caller(s -> caller);
+            auto it = std::find_if(ret.begin(), ret.end(), [&](const FfiTraceEntry& e) {
+                return e.caller == caller && e.entry == s -> entry;
+            });
+            if(it != ret.end()) {
+                it -> calls += calls;
+            } else {
+                ret.push_back(FfiTraceEntry { s -> entry, caller, calls });
+            }
+        }
+        std::sort(ret.begin(), ret.end(), [](const FfiTraceEntry& a, const FfiTraceEntry& b) {
+            return a.calls > b.calls;
+        });
+#endif
+        return ret;
+    }
+
+    // Per-entry-point totals, followed by the per-wrapper breakdown.
+    static void Dump(FILE *out) {
+        std::vector<FfiTraceEntry> entries = Report();
+
+        std::vector<std::pair<std::string, unsigned long long>> totals;
+        for(const FfiTraceEntry& e : entries) {
+            auto it = std::find_if(totals.begin(), totals.end(), [&](const std::pair<std::string, unsigned long long>& t) {
+                return t.first == e.entry;
+            });
+            if(it != totals.end()) {
+                it -> second += e.calls;
+            } else {
+                totals.push_back(std::make_pair(e.entry, e.calls));
+            }
+        }
+        std::sort(totals.begin(), totals.end(), [](const std::pair<std::string, unsigned long long>& a, const std::pair<std::string, unsigned long long>& b) {
+            return a.second > b.second;
+        });
+
+        fprintf(out, "FFI calls by entry point:\n");
+        for(const std::pair<std::string, unsigned long long>& t : totals) {
+            fprintf(out, "%12llu  %s\n", t.second, t.first.c_str());
+        }
+        fprintf(out, "FFI calls by wrapper:\n");
+        for(const FfiTraceEntry& e : entries) {
+            fprintf(out, "%12llu  %s <- %s\n", e.calls, e.entry.c_str(), e.caller.c_str());
+        }
+    }
+
+    // Dumps to stderr when the process exits normally.
+    static void DumpAtExit() {
+        static std::atomic<bool> registered { false };
+        if(!registered.exchange(true)) {
+            std::atexit([]() {
+                Dump(stderr);
+            });
+        }
+    }
+
+    // Zeroes all counters. Not synchronized with calls in flight.
+    static void Reset() {
+#ifdef HX_ORT_TRACE_FFI
+        for(ffi_trace_detail::Site *s = ffi_trace_detail::Site::Head().load(std::memory_order_acquire); s; s = s -> next) {
+            s -> calls.store(0, std::memory_order_relaxed);
+        }
+#endif
+    }
+};
+
+} // namespace ort
+} // namespace hexagon
+
+#ifdef HX_ORT_TRACE_FFI
+#define HX_ORT_FFI(fn) (::hexagon::ort::ffi_trace_detail::hit([](const char *caller) -> ::hexagon::ort::ffi_trace_detail::Site& { \
+    static ::hexagon::ort::ffi_trace_detail::Site site(#fn, caller); \
+    return site; \
+}(__PRETTY_FUNCTION__), fn))
+#else
+#define HX_ORT_FFI(fn) fn
+#endif
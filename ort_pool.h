@@ -0,0 +1,500 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include <type_traits>
+#include <cstdint>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "ort.h"
+
+namespace hexagon {
+namespace ort {
+
+namespace pool_detail {
+    // A unit of work. Runs on whichever worker takes it.
+    struct Task {
+        std::function<void (Runtime&)> run;
+        std::atomic<Task *> next { nullptr };
+    };
+
+    // Multi-producer, single-consumer queue (Vyukov). Submitters push
+    // from any thread. Consumers take turns through TryDrain, so an idle
+    // worker can empty the inbox of a busy one.
+    class Inbox {
+    private:
+        Task stub;
+        std::atomic<Task *> head;
+        Task *tail;
+        std::atomic<bool> consuming { false };
+
+    public:
+        Inbox() : head(&stub), tail(&stub) {}
+        Inbox(const Inbox& other) = delete;
+
+        void Push(Task *t) noexcept {
+            t -> next.store(nullptr, std::memory_order_relaxed);
+            Task *prev = head.exchange(t, std::memory_order_acq_rel);
+            prev -> next.store(t, std::memory_order_release);
+        }
+
+        // Returns nullptr when empty, or when a push is halfway done.
+        Task * Pop() noexcept {
+            Task *t = tail;
+            Task *next = t -> next.load(std::memory_order_acquire);
+            if(t == &stub) {
+                if(next == nullptr) {
+                    return nullptr;
+                }
+                tail = next;
+                t = next;
+                next = next -> next.load(std::memory_order_acquire);
+            }
+            if(next != nullptr) {
+                tail = next;
+                return t;
+            }
+            if(t != head.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            Push(&stub);
+            next = t -> next.load(std::memory_order_acquire);
+            if(next != nullptr) {
+                tail = next;
+                return t;
+            }
+            return nullptr;
+        }
+
+        // Moves everything currently in the inbox to `out`. Returns false
+        // if another worker is already draining it.
+        template<class Out>
+        bool TryDrain(Out& out) {
+            if(consuming.exchange(true, std::memory_order_acquire)) {
+                return false;
+            }
+            while(Task *t = Pop()) {
+                out.Push(t);
+            }
+            consuming.store(false, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // Chase-Lev work-stealing deque. The owner pushes and pops at the
+    // bottom; other workers steal from the top.
+    class StealingDeque {
+    private:
+        struct Ring {
+            int64_t capacity;
+            std::unique_ptr<std::atomic<Task *>[]> slots;
+
+            Ring(int64_t _capacity) : capacity(_capacity), slots(new std::atomic<Task *>[_capacity]) {}
+
+            Task * Get(int64_t i) const noexcept {
+                return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+            }
+
+            void Put(int64_t i, Task *t) noexcept {
+                slots[i & (capacity - 1)].store(t, std::memory_order_relaxed);
+            }
+        };
+
+        std::atomic<int64_t> top { 0 };
+        std::atomic<int64_t> bottom { 0 };
+        std::atomic<Ring *> ring;
+
+        // Outgrown rings. Thieves may still be reading them, so they are
+        // kept until the deque is destroyed.
+        std::vector<std::unique_ptr<Ring>> rings;
+
+        Ring * grow(Ring *old, int64_t t, int64_t b) {
+            rings.emplace_back(new Ring(old -> capacity * 2));
+            Ring *r = rings.back().get();
+            for(int64_t i = t; i < b; i++) {
+                r -> Put(i, old -> Get(i));
+            }
+            ring.store(r, std::memory_order_release);
+            return r;
+        }
+
+    public:
+        StealingDeque() {
+            rings.emplace_back(new Ring(64));
+            ring.store(rings.back().get(), std::memory_order_relaxed);
+        }
+        StealingDeque(const StealingDeque& other) = delete;
+
+        // Owner only.
+        void Push(Task *t) {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t tp = top.load(std::memory_order_acquire);
+            Ring *r = ring.load(std::memory_order_relaxed);
+            if(b - tp > r -> capacity - 1) {
+                r = grow(r, tp, b);
+            }
+            r -> Put(b, t);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        // Owner only.
+        Task * Pop() noexcept {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Ring *r = ring.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if(t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Task *ret = r -> Get(b);
+            if(t == b) {
+                // Last element: race the thieves for it.
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    ret = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return ret;
+        }
+
+        // Any thread. Returns nullptr when empty or when it lost a race.
+        Task * Steal() noexcept {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if(t >= b) {
+                return nullptr;
+            }
+
+            Ring *r = ring.load(std::memory_order_acquire);
+            Task *ret = r -> Get(t);
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return ret;
+        }
+    };
+} // namespace pool_detail
+
+// A fixed set of Runtimes, each owned by its own worker thread.
+//
+// Register functions and setup steps first, then call Start(). Every
+// registration is replayed into each worker's Runtime, so any worker can
+// run any job. Submitted jobs go to a worker's inbox round-robin; a worker
+// moves its inbox into a work-stealing deque, and idle workers steal from
+// the others.
+//
+// Values belong to the Runtime that created them. Only scalar results
+// (ints, floats, bools, null) are meaningful outside the worker; use the
+// callback forms to inspect anything else on the worker thread.
+class RuntimePool {
+public:
+    typedef std::function<void (Runtime&)> Job;
+    typedef std::function<Function (Runtime&)> FunctionFactory;
+    typedef std::function<void (Runtime&, Value)> InvokeCallback;
+
+private:
+    struct Worker {
+        pool_detail::Inbox inbox;
+        pool_detail::StealingDeque deque;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<Job> setup;
+    bool pin_threads;
+    bool started = false;
+
+    std::atomic<unsigned int> next_worker { 0 };
+    std::atomic<bool> stopping { false };
+
+    // Tasks in any inbox or deque, and tasks not yet finished.
+    std::atomic<size_t> queued { 0 };
+    std::atomic<size_t> outstanding { 0 };
+    std::atomic<unsigned long long> failed_jobs { 0 };
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<unsigned int> n_sleeping { 0 };
+    std::condition_variable idle_cv;
+
+    void check_not_started() const {
+        if(started) {
+            throw std::logic_error("RuntimePool: Registration after Start()");
+        }
+    }
+
+    void enqueue(Job job) {
+        if(!started) {
+            throw std::logic_error("RuntimePool: Submission before Start()");
+        }
+
+        pool_detail::Task *t = new pool_detail::Task();
+        t -> run = std::move(job);
+
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        unsigned int id = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        workers[id] -> inbox.Push(t);
+        queued.fetch_add(1, std::memory_order_seq_cst);
+
+        if(n_sleeping.load(std::memory_order_seq_cst) > 0) {
+            {
+                std::lock_guard<std::mutex> lg(sleep_mutex);
+            }
+            sleep_cv.notify_all();
+        }
+    }
+
+    pool_detail::Task * take(unsigned int self) {
+        Worker& w = *workers[self];
+
+        w.inbox.TryDrain(w.deque);
+        if(pool_detail::Task *t = w.deque.Pop()) {
+            return t;
+        }
+
+        for(size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            if(pool_detail::Task *t = victim.deque.Steal()) {
+                return t;
+            }
+        }
+
+        // Jobs still sitting in the inbox of a worker that is busy.
+        for(size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            if(victim.inbox.TryDrain(w.deque)) {
+                if(pool_detail::Task *t = w.deque.Pop()) {
+                    return t;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void finish_task() {
+        if(outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            {
+                std::lock_guard<std::mutex> lg(sleep_mutex);
+            }
+            idle_cv.notify_all();
+        }
+    }
+
+    void worker_main(unsigned int self, std::promise<void>& ready) {
+#ifdef __linux__
+        if(pin_threads) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(self % std::thread::hardware_concurrency(), &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#endif
+
+        Runtime rt;
+
+        try {
+            for(const Job& step : setup) {
+                step(rt);
+            }
+        } catch(...) {
+            ready.set_exception(std::current_exception());
+            return;
+        }
+        ready.set_value();
+
+        for(;;) {
+            pool_detail::Task *t = take(self);
+            if(t != nullptr) {
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                try {
+                    t -> run(rt);
+                } catch(...) {
+                    failed_jobs.fetch_add(1, std::memory_order_relaxed);
+                }
+                delete t;
+                finish_task();
+                continue;
+            }
+
+            // `queued` covers a task from just before it is visible in an
+            // inbox until just after a worker has taken it, so it can be
+            // nonzero with nothing left to take. Sleeping would return at
+            // once; yield until the other thread gets there instead.
+            if(queued.load(std::memory_order_seq_cst) > 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lk(sleep_mutex);
+            n_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            // Tasks still in flight to some inbox show up in `queued`, so
+            // this cannot miss a wakeup.
+            sleep_cv.wait(lk, [this]() {
+                return queued.load(std::memory_order_seq_cst) > 0 || stopping.load();
+            });
+            n_sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+            if(stopping.load() && queued.load() == 0) {
+                break;
+            }
+        }
+    }
+
+    // Each worker's Runtime keeps its own StaticSlot per key.
+    static Value invoke_on(Runtime& rt, const std::string& key, const std::vector<Value>& args) {
+        StaticSlot slot = rt.ResolveStatic(key.c_str());
+        if(!slot) {
+            throw std::runtime_error("RuntimePool: Unknown static object");
+        }
+        return rt.Invoke(slot.Get(), args);
+    }
+
+public:
+    explicit RuntimePool(
+        unsigned int n_workers = std::thread::hardware_concurrency(),
+        bool _pin_threads = false
+    ) : pin_threads(_pin_threads) {
+        if(n_workers == 0) {
+            n_workers = 1;
+        }
+        for(unsigned int i = 0; i < n_workers; i++) {
+            workers.emplace_back(new Worker());
+        }
+    }
+
+    RuntimePool(const RuntimePool& other) = delete;
+
+    // Finishes all queued jobs, then joins the workers.
+    ~RuntimePool() {
+        {
+            std::lock_guard<std::mutex> lg(sleep_mutex);
+            stopping.store(true);
+        }
+        sleep_cv.notify_all();
+        for(std::unique_ptr<Worker>& w : workers) {
+            if(w -> thread.joinable()) {
+                w -> thread.join();
+            }
+        }
+    }
+
+    unsigned int Size() const {
+        return workers.size();
+    }
+
+    // Runs `fn` on every worker's Runtime before it takes any jobs.
+    RuntimePool& Setup(Job fn) {
+        check_not_started();
+        setup.push_back(std::move(fn));
+        return *this;
+    }
+
+    // Functions are consumed by AttachFunction, so each worker builds its
+    // own copy from `factory`.
+    RuntimePool& AttachFunction(const std::string& key, FunctionFactory factory) {
+        return Setup([key, factory](Runtime& rt) {
+            Function f = factory(rt);
+            rt.AttachFunction(key.c_str(), f);
+        });
+    }
+
+    // Starts the workers and waits until every one has run its setup.
+    // Rethrows the first setup failure.
+    void Start() {
+        check_not_started();
+        started = true;
+
+        std::vector<std::promise<void>> ready(workers.size());
+        for(unsigned int i = 0; i < workers.size(); i++) {
+            workers[i] -> thread = std::thread([this, i, &ready]() {
+                worker_main(i, ready[i]);
+            });
+        }
+        // Wait for all of them before rethrowing; `ready` lives on this
+        // stack frame.
+        std::exception_ptr error;
+        for(std::promise<void>& p : ready) {
+            try {
+                p.get_future().get();
+            } catch(...) {
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Fire-and-forget. Exceptions escaping `job` are counted in FailedJobs().
+    void Post(Job job) {
+        enqueue(std::move(job));
+    }
+
+    template<class F>
+    std::future<typename std::invoke_result<F, Runtime&>::type> Submit(F&& job) {
+        typedef typename std::invoke_result<F, Runtime&>::type R;
+
+        std::shared_ptr<std::promise<R>> p = std::make_shared<std::promise<R>>();
+        std::future<R> ret = p -> get_future();
+        enqueue([p, job = std::forward<F>(job)](Runtime& rt) mutable {
+            try {
+                if constexpr (std::is_void<R>::value) {
+                    job(rt);
+                    p -> set_value();
+                } else {
+                    p -> set_value(job(rt));
+                }
+            } catch(...) {
+                p -> set_exception(std::current_exception());
+            }
+        });
+        return ret;
+    }
+
+    // Invokes the static `key` on some worker. Arguments must be scalars.
+    std::future<Value> Invoke(const std::string& key, std::vector<Value> args) {
+        return Submit([key, args = std::move(args)](Runtime& rt) {
+            return invoke_on(rt, key, args);
+        });
+    }
+
+    // Callback form: `cb` runs on the worker with that worker's Runtime.
+    void Invoke(const std::string& key, std::vector<Value> args, InvokeCallback cb) {
+        Post([key, args = std::move(args), cb = std::move(cb)](Runtime& rt) {
+            cb(rt, invoke_on(rt, key, args));
+        });
+    }
+
+    // Blocks until every job submitted so far has finished.
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lk(sleep_mutex);
+        idle_cv.wait(lk, [this]() {
+            return outstanding.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+    unsigned long long FailedJobs() const {
+        return failed_jobs.load(std::memory_order_relaxed);
+    }
+};
+
+} // namespace ort
+} // namespace hexagon
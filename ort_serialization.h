@@ -0,0 +1,318 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+namespace hexagon {
+namespace serialization {
+
+// Output sinks accepted by the JSON and binary writers.
+// A sink only needs `Append(const char *, size_t)` and `Append(char)`.
+
+// Counts bytes without storing them. Used for the size pre-pass.
+class CountingSink {
+public:
+    size_t size = 0;
+
+    void Append(const char *, size_t len) {
+        size += len;
+    }
+
+    void Append(char) {
+        size++;
+    }
+};
+
+// Writes into preallocated memory. The caller is responsible for
+// making the buffer large enough.
+class PointerSink {
+private:
+    char *cursor;
+
+public:
+    PointerSink(char *_cursor) : cursor(_cursor) {}
+
+    void Append(const char *data, size_t len) {
+        memcpy(cursor, data, len);
+        cursor += len;
+    }
+
+    void Append(char c) {
+        *cursor++ = c;
+    }
+};
+
+// Appends to a caller-owned string.
+class StringSink {
+private:
+    std::string& out;
+
+public:
+    StringSink(std::string& _out) : out(_out) {}
+
+    void Append(const char *data, size_t len) {
+        out.append(data, len);
+    }
+
+    void Append(char c) {
+        out.push_back(c);
+    }
+};
+
+// Buffers output and hands it to a callback in fixed-size chunks.
+// Call Flush() when done; the destructor flushes too, but swallows errors.
+class CallbackSink {
+public:
+    typedef std::function<void (const char *data, size_t len)> Callback;
+
+private:
+    Callback cb;
+    char buf[4096];
+    size_t used = 0;
+
+public:
+    CallbackSink(const Callback& _cb) : cb(_cb) {}
+    CallbackSink(const CallbackSink& other) = delete;
+
+    ~CallbackSink() {
+        try {
+            Flush();
+        } catch(...) {}
+    }
+
+    void Append(const char *data, size_t len) {
+        if(used + len > sizeof(buf)) {
+            Flush();
+            if(len > sizeof(buf)) {
+                cb(data, len);
+                return;
+            }
+        }
+        memcpy(buf + used, data, len);
+        used += len;
+    }
+
+    void Append(char c) {
+        if(used == sizeof(buf)) {
+            Flush();
+        }
+        buf[used++] = c;
+    }
+
+    void Flush() {
+        if(used > 0) {
+            size_t n = used;
+            used = 0;
+            cb(buf, n);
+        }
+    }
+};
+
+// Writes to a file descriptor.
+class FdSink : public CallbackSink {
+public:
+    FdSink(int fd) : CallbackSink([fd](const char *data, size_t len) {
+        while(len > 0) {
+            ssize_t n = write(fd, data, len);
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                throw std::runtime_error("FdSink: write failed");
+            }
+            data += n;
+            len -= (size_t) n;
+        }
+    }) {}
+};
+
+namespace json_detail {
+    // Bytes that have to be written as \u00XX. Everything else
+    // (including bytes >= 0x80) is copied through unchanged.
+    struct EscapeTable {
+        bool needs_escape[256];
+
+        constexpr EscapeTable() : needs_escape() {
+            for(int i = 0; i < 0x20; i++) {
+                needs_escape[i] = true;
+            }
+            needs_escape[(unsigned char) '"'] = true;
+            needs_escape[(unsigned char) '\\'] = true;
+        }
+    };
+
+    static constexpr EscapeTable escape_table;
+    static constexpr char hex_digits[] = "0123456789abcdef";
+} // namespace json_detail
+
+// Writes `s` with JSON escaping (without the surrounding quotes).
+template<class Sink>
+void WriteJsonEscaped(Sink& sink, const char *s, size_t len) {
+    const char *run = s;
+    const char *end = s + len;
+
+    for(const char *p = run; p != end; p++) {
+        unsigned char c = (unsigned char) *p;
+        if(json_detail::escape_table.needs_escape[c]) {
+            if(p != run) {
+                sink.Append(run, p - run);
+            }
+            const char esc[6] = {
+                '\\', 'u', '0', '0',
+                json_detail::hex_digits[c >> 4],
+                json_detail::hex_digits[c & 0xf]
+            };
+            sink.Append(esc, sizeof(esc));
+            run = p + 1;
+        }
+    }
+    if(end != run) {
+        sink.Append(run, end - run);
+    }
+}
+
+template<class Sink>
+void WriteJsonI64(Sink& sink, long long v) {
+    char buf[24];
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), v);
+    sink.Append(buf, r.ptr - buf);
+}
+
+// Matches the default std::ostream formatting (%g, precision 6).
+template<class Sink>
+void WriteJsonF64(Sink& sink, double v) {
+    char buf[32];
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, 6);
+    sink.Append(buf, r.ptr - buf);
+}
+
+template<class Sink>
+void WriteJsonBool(Sink& sink, bool v) {
+    if(v) {
+        sink.Append("true", 4);
+    } else {
+        sink.Append("false", 5);
+    }
+}
+
+// Building blocks of the compact binary bytecode format written by
+// FunctionWriter::WriteBinary; the layout is described there. It is a
+// storage format: no backend loads it, so LoadVirtual only ever sees
+// the JSON that TranscodeBinaryToJson turns it back into.
+//
+// Operand payloads: I64 is a zigzag varint, F64 is 8 little-endian bytes,
+// String is a varint index into the string pool, bools have no payload.
+static constexpr char BinaryMagic[4] = { 'H', 'X', 'B', 0x02 };
+
+enum class BinaryTag : unsigned char {
+    I64 = 0,
+    F64 = 1,
+    String = 2,
+    BoolFalse = 3,
+    BoolTrue = 4,
+};
+
+template<class Sink>
+void WriteVarint(Sink& sink, unsigned long long v) {
+    char buf[10];
+    size_t n = 0;
+    while(v >= 0x80) {
+        buf[n++] = (char) ((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char) v;
+    sink.Append(buf, n);
+}
+
+template<class Sink>
+void WriteZigzag(Sink& sink, long long v) {
+    WriteVarint(sink, ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63));
+}
+
+template<class Sink>
+void WriteF64LE(Sink& sink, double v) {
+    unsigned long long bits;
+    memcpy(&bits, &v, sizeof(bits));
+    char buf[8];
+    for(int i = 0; i < 8; i++) {
+        buf[i] = (char) (bits >> (i * 8));
+    }
+    sink.Append(buf, sizeof(buf));
+}
+
+// Bounds-checked cursor over binary bytecode.
+class BinaryReader {
+private:
+    const unsigned char *cursor;
+    const unsigned char *end;
+
+    [[noreturn]] static void malformed() {
+        throw std::runtime_error("Malformed binary bytecode");
+    }
+
+public:
+    BinaryReader(const unsigned char *code, size_t len) : cursor(code), end(code + len) {}
+
+    bool AtEnd() const {
+        return cursor == end;
+    }
+
+    unsigned char ReadByte() {
+        if(cursor == end) malformed();
+        return *cursor++;
+    }
+
+    unsigned long long ReadVarint() {
+        unsigned long long v = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            unsigned char b = ReadByte();
+            v |= (unsigned long long) (b & 0x7f) << shift;
+            if(!(b & 0x80)) return v;
+        }
+        malformed();
+    }
+
+    long long ReadZigzag() {
+        unsigned long long v = ReadVarint();
+        return (long long) (v >> 1) ^ -(long long) (v & 1);
+    }
+
+    double ReadF64LE() {
+        if(end - cursor < 8) malformed();
+        unsigned long long bits = 0;
+        for(int i = 0; i < 8; i++) {
+            bits |= (unsigned long long) cursor[i] << (i * 8);
+        }
+        cursor += 8;
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    // Returns a view into the underlying buffer.
+    const char * ReadBytes(size_t len) {
+        if((size_t) (end - cursor) < len) malformed();
+        const char *ret = (const char *) cursor;
+        cursor += len;
+        return ret;
+    }
+
+    // Reads a (varint len, bytes) table into views over the buffer.
+    void ReadStringTable(std::vector<std::pair<const char *, size_t>>& out) {
+        unsigned long long n = ReadVarint();
+        if(n > (unsigned long long) (end - cursor)) malformed();
+        out.clear();
+        out.reserve(n);
+        for(unsigned long long i = 0; i < n; i++) {
+            size_t len = ReadVarint();
+            out.push_back(std::make_pair(ReadBytes(len), len));
+        }
+    }
+};
+
+} // namespace serialization
+} // namespace hexagon
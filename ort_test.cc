@@ -1,27 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <limits.h>
 #include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <memory_resource>
+#include <optional>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 #include "ort.h"
 #include "ort_assembly_writer.h"
+#include "ort_pool.h"
+#include "ort_bench.h"
+#include "ort_alloc_count.h"
 
 using namespace hexagon;
 
-ort::Function build_call_tester() {
+assembly_writer::FunctionWriter write_call_tester() {
     using namespace assembly_writer;
 
     FunctionWriter fwriter;
 
-    BasicBlockWriter init_bb;
-    init_bb
+    fwriter.NewBlock()
         .Write(BytecodeOp("LoadNull"))
         .Write(BytecodeOp("LoadString", Operand::String("set_ret")))
         .Write(BytecodeOp("GetStatic"))
         .Write(BytecodeOp("Call", Operand::I64(0)))
         .Write(BytecodeOp("Return"));
 
-    fwriter.Write(init_bb);
-    return fwriter.Build();
+    return fwriter;
+}
+
+ort::Function build_call_tester() {
+    return write_call_tester().Build();
 }
 
 ort::Function build_call_tester_with_callee_as_param() {
@@ -36,63 +52,88 @@ ort::Function build_call_tester_with_callee_as_param() {
         .Write(BytecodeOp("Call", Operand::I64(0)))
         .Write(BytecodeOp("Return"));
 
-    fwriter.Write(init_bb);
+    fwriter.Write(std::move(init_bb));
     return fwriter.Build();
 }
 
-ort::Function build_sum_tester() {
+assembly_writer::FunctionWriter write_sum_tester() {
     using namespace assembly_writer;
 
     FunctionWriter fwriter;
 
     fwriter.Write(
         BasicBlockWriter()
-            .Write(BytecodeOp("InitLocal", Operand::I64(3)))
-            .Write(BytecodeOp("GetArgument", Operand::I64(0)))
-            .Write(BytecodeOp("SetLocal", Operand::I64(0)))
-            .Write(BytecodeOp("GetArgument", Operand::I64(1)))
-            .Write(BytecodeOp("SetLocal", Operand::I64(1)))
-            .Write(BytecodeOp("LoadInt", Operand::I64(0)))
-            .Write(BytecodeOp("SetLocal", Operand::I64(2)))
-            .Write(BytecodeOp("Branch", Operand::I64(1)))
+            .InitLocal(3)
+            .GetArgument(0)
+            .SetLocal(0)
+            .GetArgument(1)
+            .SetLocal(1)
+            .LoadInt(0)
+            .SetLocal(2)
+            .Branch(1)
     ).Write(
         BasicBlockWriter()
-            .Write(BytecodeOp("GetLocal", Operand::I64(1)))
-            .Write(BytecodeOp("GetLocal", Operand::I64(0)))
-            .Write(BytecodeOp("TestLt"))
-            .Write(BytecodeOp("ConditionalBranch", Operand::I64(2), Operand::I64(3)))
+            .GetLocal(1)
+            .GetLocal(0)
+            .TestLt()
+            .ConditionalBranch(2, 3)
     ).Write(
         BasicBlockWriter()
-            .Write(BytecodeOp("LoadInt", Operand::I64(1)))
-            .Write(BytecodeOp("GetLocal", Operand::I64(0)))
-            .Write(BytecodeOp("IntAdd"))
-            .Write(BytecodeOp("Dup"))
-            .Write(BytecodeOp("SetLocal", Operand::I64(0)))
-            .Write(BytecodeOp("GetLocal", Operand::I64(2)))
-            .Write(BytecodeOp("IntAdd"))
-            .Write(BytecodeOp("SetLocal", Operand::I64(2)))
-            .Write(BytecodeOp("Branch", Operand::I64(1)))
+            .LoadInt(1)
+            .GetLocal(0)
+            .IntAdd()
+            .Dup()
+            .SetLocal(0)
+            .GetLocal(2)
+            .IntAdd()
+            .SetLocal(2)
+            .Branch(1)
     ).Write(
         BasicBlockWriter()
-            .Write(BytecodeOp("GetLocal", Operand::I64(2)))
-            .Write(BytecodeOp("Return"))
+            .GetLocal(2)
+            .Return()
     );
 
-    return fwriter.Build();
+    return fwriter;
+}
+
+ort::Function build_sum_tester() {
+    return write_sum_tester().Build();
 }
 
-void bench(const char *name, const std::function<void (int n)>& cb) {
-    const int n = 1000000;
+// The typed writers take only their operand's own kind of argument; these
+// would otherwise compile through implicit conversions.
+#define HX_WRITER_ACCEPTS(name) \
+    template<class A, class = void> \
+    struct writer_accepts_##name : std::false_type {}; \
+    template<class A> \
+    struct writer_accepts_##name<A, decltype((void) std::declval<assembly_writer::BasicBlockWriter&>().name(std::declval<A>()))> : std::true_type {};
 
-    printf("Bench: %s\n", name);
-    clock_t start_time = clock();
+HX_WRITER_ACCEPTS(GetLocal)
+HX_WRITER_ACCEPTS(LoadBool)
+HX_WRITER_ACCEPTS(LoadFloat)
+HX_WRITER_ACCEPTS(LoadString)
+#undef HX_WRITER_ACCEPTS
+
+template<class A1, class A2, class = void>
+struct writer_accepts_ConditionalBranch : std::false_type {};
+template<class A1, class A2>
+struct writer_accepts_ConditionalBranch<A1, A2, decltype((void) assembly_writer::BasicBlockWriter().ConditionalBranch(std::declval<A1>(), std::declval<A2>()))> : std::true_type {};
 
-    cb(n);
+static_assert(writer_accepts_GetLocal<int>::value && writer_accepts_GetLocal<long long>::value && writer_accepts_GetLocal<unsigned int>::value, "GetLocal takes integers");
+static_assert(!writer_accepts_GetLocal<double>::value && !writer_accepts_GetLocal<bool>::value, "GetLocal(1.5) and GetLocal(true) must not compile");
+static_assert(writer_accepts_LoadBool<bool>::value, "LoadBool takes bool");
+static_assert(!writer_accepts_LoadBool<int>::value && !writer_accepts_LoadBool<double>::value, "LoadBool(5) must not compile");
+static_assert(writer_accepts_LoadFloat<double>::value && !writer_accepts_LoadFloat<int>::value, "LoadFloat takes floating point only");
+static_assert(writer_accepts_LoadString<const char *>::value && writer_accepts_LoadString<std::string>::value, "LoadString takes strings");
+static_assert(!writer_accepts_LoadString<int>::value && !writer_accepts_LoadString<std::nullptr_t>::value, "LoadString(0) must not compile");
+static_assert(writer_accepts_ConditionalBranch<int, int>::value && !writer_accepts_ConditionalBranch<int, double>::value, "Rvalue writers are checked too");
 
-    clock_t end_time = clock();
-    unsigned long long elapsed_ns = ((end_time - start_time) / (CLOCKS_PER_SEC / 1000)) * 1000000;
+static benchmark::BenchSuite bench_suite;
 
-    printf("Done. %llu ns / iter\n", elapsed_ns / (unsigned long long) n);
+// Returns the median ns / iter. Every result also goes to bench_output.txt.
+double bench(const char *name, const std::function<void (int n)>& cb, const int n = 1000000) {
+    return bench_suite.Run(name, cb, n).median_ns;
 }
 
 void test_sum() {
@@ -107,20 +148,18 @@ void test_sum() {
     long long val = 0;
 
     bench("sum", [&](int n) {
-        std::vector<ort::Value> params;
-        params.push_back(ort::Value::FromInt(0));
-        params.push_back(ort::Value::FromInt(n));
-
-        ort::Value ret = rt.Invoke(entry, params);
+        ort::Value ret = rt.Invoke(entry, ort::Value::FromInt(0), ort::Value::FromInt(n));
         val = ret.ExtractI64();
     });
 
     printf("%lld\n", val);
 }
 
-class Adder : public ort::ProxiedObject {
+class Adder : public ort::TypedProxiedObject<Adder> {
 public:
-    virtual ort::Value Call(const std::vector<ort::Value>& args) {
+    using ort::ProxiedObject::Call;
+
+    virtual ort::Value Call(ort::ArgSpan args) {
         return ort::Value::FromInt(args.at(0).ExtractI64() + args.at(1).ExtractI64());
     }
 
@@ -137,6 +176,34 @@ void test_object_handle() {
             ort::ObjectHandle handle = val.ToObjectHandle(rt);
         }
     });
+
+    bench("object_handle_borrowed", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ort::BorrowedObjectHandle handle = val.BorrowObjectHandle(rt);
+        }
+    });
+}
+
+// A borrowed handle is released when it goes out of scope, so it does not
+// keep its object alive past the borrow.
+void test_borrowed_handle_release() {
+    ort::Runtime rt;
+    ort::Value val = ort::Value::FromString("Hello world", rt);
+
+    alloc_count::Scope scope;
+    {
+        ort::BorrowedObjectHandle handle = val.BorrowObjectHandle(rt);
+        ort::BorrowedObjectHandle moved = std::move(handle);
+    }
+    alloc_count::Counts delta = scope.Delta();
+
+#ifdef HX_ALLOC_COUNT_MALLOC
+    if(delta.mallocs == 0 || delta.mallocs != delta.frees) {
+        throw std::runtime_error("Borrowed handle not released at scope exit");
+    }
+#else
+    (void) delta;
+#endif
 }
 
 void test_proxied_downcast() {
@@ -145,6 +212,8 @@ void test_proxied_downcast() {
     ort::Value pv = proxy.Pin(rt);
     ort::ObjectHandle h = pv.ToObjectHandle(rt);
 
+    // Baseline for As<T>, which does not need RTTI.
+#if defined(__cpp_rtti) || defined(__GXX_RTTI)
     bench("proxied_downcast", [&](int n) {
         for(int i = 0; i < n; i++) {
             Adder *inner = dynamic_cast<Adder *>(h.ToProxiedObject());
@@ -153,6 +222,29 @@ void test_proxied_downcast() {
             }
         }
     });
+#endif
+
+    bench("proxied_downcast_tagged", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            Adder *inner = h.As<Adder>();
+            if(inner -> local_add(1, 2) != 3) {
+                throw std::runtime_error("Bad add result");
+            }
+        }
+    });
+
+    bench("proxied_downcast_value_as", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            Adder *inner = pv.As<Adder>(rt);
+            if(inner -> local_add(1, 2) != 3) {
+                throw std::runtime_error("Bad add result");
+            }
+        }
+    });
+
+    if(ort::Value::FromInt(1).As<Adder>(rt) != nullptr) {
+        throw std::runtime_error("As<T> accepted a non-object");
+    }
 }
 
 void test_proxied() {
@@ -189,7 +281,7 @@ void test_proxied() {
 
     bench("proxied", [&](int n) {
         for(int i = 0; i < n; i++) {
-            ret = rt.Invoke(entry, std::vector<ort::Value>()).ExtractI64();
+            ret = rt.Invoke(entry).ExtractI64();
         }
     });
     printf("%d\n", ret);
@@ -221,19 +313,1596 @@ void test_call() {
 
     bench("invoke", [&](int n) {
         for(int i = 0; i < n; i++) {
-            rt.Invoke(entry, std::vector<ort::Value>());
+            rt.Invoke(entry);
         }
     });
 
     printf("%d\n", ret_val);
 }
 
-int main() {
-    test_call();
-    test_sum();
-    test_proxied();
-    test_object_handle();
-    test_proxied_downcast();
+void write_synthetic_blocks(assembly_writer::FunctionWriter& fwriter, int n_blocks) {
+    using namespace assembly_writer;
+
+    for(int i = 0; i < n_blocks; i++) {
+        fwriter.NewBlock()
+            .Write(BytecodeOp("LoadString", Operand::String("key_\"quoted\"\tname")))
+            .Write(BytecodeOp("GetStatic"))
+            .Write(BytecodeOp("LoadFloat", Operand::F64(3.14159 * i)))
+            .Write(BytecodeOp("LoadInt", Operand::I64(i * 1000003LL)))
+            .Write(BytecodeOp("LoadBool", Operand::Bool(i % 2 == 0)))
+            .Write(BytecodeOp("GetLocal", Operand::I64(i % 16)))
+            .Write(BytecodeOp("IntAdd"))
+            .Write(BytecodeOp("ConditionalBranch", Operand::I64(i + 1), Operand::I64(0)));
+    }
+}
+
+assembly_writer::FunctionWriter build_synthetic_program(int n_blocks) {
+    assembly_writer::FunctionWriter fwriter;
+    write_synthetic_blocks(fwriter, n_blocks);
+    return fwriter;
+}
+
+static_assert(std::is_same<decltype(assembly_writer::BasicBlockWriter().LoadNull()), assembly_writer::BasicBlockWriter>::value,
+    "Rvalue writers return by value, so `auto&&` chains do not dangle");
+
+// Blocks are moved, not copied, into the writer and handed to translators
+// in place.
+void test_writer_no_copy() {
+    using namespace assembly_writer;
+
+    FunctionWriter fwriter([&](BasicBlockList& blocks) {
+        if(&blocks[0] != &fwriter.Block(0) || blocks[0].opcodes.size() != 2) {
+            throw std::runtime_error("Translator did not get the writer's blocks");
+        }
+        blocks[0].Return();
+    });
+
+    BasicBlockWriter bb = BasicBlockWriter().LoadInt(1).LoadInt(2);
+    const BytecodeOp *ops = bb.opcodes.data();
+    fwriter.Write(std::move(bb));
+    if(fwriter.Block(0).opcodes.data() != ops) {
+        throw std::runtime_error("Block was copied into the writer");
+    }
+
+    auto&& chained = BasicBlockWriter().LoadNull().Return();
+    if(chained.opcodes.size() != 2) {
+        throw std::runtime_error("Chained block lost ops");
+    }
+
+    fwriter.Build();
+    if(fwriter.Block(0).opcodes.size() != 3) {
+        throw std::runtime_error("Translator edit was lost");
+    }
+
+    // Translators taking the old std::vector list still see and edit the
+    // blocks.
+    FunctionWriter legacy([](std::vector<BasicBlockWriter>& blocks) {
+        blocks[0].Return();
+        blocks.push_back(BasicBlockWriter().LoadNull().Return());
+    });
+    legacy.NewBlock().LoadNull();
+    legacy.Block(0).opcodes.reserve(8);
+    const BytecodeOp *legacy_ops = legacy.Block(0).opcodes.data();
+    legacy.Build();
+    if(legacy.BlockCount() != 2 || legacy.Block(0).opcodes.size() != 2 || legacy.Block(1).Id() != 1) {
+        throw std::runtime_error("Vector translator edits were lost");
+    }
+    if(legacy.Block(0).opcodes.data() != legacy_ops) {
+        throw std::runtime_error("Vector translator copied the ops");
+    }
+}
+
+// Operands and custom names built from temporaries outlive them.
+void test_writer_owned_strings() {
+    using namespace assembly_writer;
+
+    Operand operand = Operand::String(std::string("tempo") + "rary");
+    BytecodeOp custom(std::string("Vendor") + "Op", operand);
+    Operand literal = Operand::String("literal");
+    Operand copied = operand;
+    operand = Operand::I64(1);
+
+    if(copied.GetString() != "temporary" || custom.operands[0].GetString() != "temporary") {
+        throw std::runtime_error("String operand did not own its string");
+    }
+    if(custom.Name() != "VendorOp") {
+        throw std::runtime_error("Custom opcode did not own its name");
+    }
+    custom.SetName(custom.Name().substr(2));
+    if(custom.Name() != "ndorOp" || custom.opcode != Opcode::Custom) {
+        throw std::runtime_error("SetName: Bad custom name");
+    }
+    custom.SetName("Return");
+    if(custom.opcode != Opcode::Return || custom.Name() != "Return") {
+        throw std::runtime_error("SetName: Table opcode not looked up");
+    }
+    custom.SetName(std::string("Vendor") + "Op");
+    if(!copied.string_owned || literal.string_owned) {
+        throw std::runtime_error("Literal operand was copied or owned operand was borrowed");
+    }
+
+    FunctionWriter fwriter;
+    fwriter.NewBlock().Write(custom).LoadString(std::string("key_") + "name").Return();
+    BasicBlockWriter detached;
+    detached.Write(BytecodeOp(std::string("Vendor") + "Op", Operand::String(std::string("x"))));
+    fwriter.Write(std::move(detached));
+    if(fwriter.ToJson() != "{\"basic_blocks\":[{\"opcodes\":[{\"VendorOp\":\"temporary\"},{\"LoadString\":\"key_name\"},\"Return\"]},{\"opcodes\":[{\"VendorOp\":\"x\"}]}]}") {
+        throw std::runtime_error("Owned strings written incorrectly");
+    }
+    if(fwriter.Block(0).opcodes[0].custom_name_owned || fwriter.Block(0).opcodes[0].operands[0].string_owned) {
+        throw std::runtime_error("Written op did not move its strings into the pool");
+    }
+}
+
+void test_serialize() {
+    assembly_writer::FunctionWriter fwriter = build_synthetic_program(10000);
+    std::string output;
+    size_t size = fwriter.JsonSize();
+
+    double ns = bench("serialize", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            fwriter.ToJson(output);
+        }
+    }, 100);
+
+    if(output.size() != size) {
+        throw std::runtime_error("Bad serialized size");
+    }
+    printf("%zu bytes, %.1f MB/s\n", size, ns > 0 ? (double) size * 1000.0 / ns : 0.0);
+}
+
+// Expected output recorded from the original std::ostringstream writer:
+// floats in %g with precision 6, control characters, quote and backslash
+// as \u00XX, everything else (including bytes >= 0x80) copied through.
+void test_json_golden() {
+    using namespace assembly_writer;
+
+    FunctionWriter fwriter;
+    BasicBlockWriter& bb = fwriter.NewBlock();
+    const double floats[] = { 0.0, -0.0, 1.0, 0.1, 3.14159265358979, 1234567.0, 123456.0, 1e20, 1e-5, -2.5e-300, 100.0 };
+    for(double f : floats) {
+        bb.LoadFloat(f);
+    }
+    bb.LoadInt(LLONG_MIN).LoadInt(-1).LoadInt(LLONG_MAX);
+    const char *strings[] = { "a\"b\\c", "\x01\x1f\x7f", "caf\xc3\xa9", "\xff", "tab\tnl\n" };
+    for(const char *str : strings) {
+        bb.LoadString(str);
+    }
+    bb.LoadBool(true).Write(BytecodeOp("Vendor\"Op")).Return();
+
+    const std::string expected =
+        "{\"basic_blocks\":[{\"opcodes\":["
+        "{\"LoadFloat\":0},{\"LoadFloat\":-0},{\"LoadFloat\":1},{\"LoadFloat\":0.1},"
+        "{\"LoadFloat\":3.14159},{\"LoadFloat\":1.23457e+06},{\"LoadFloat\":123456},"
+        "{\"LoadFloat\":1e+20},{\"LoadFloat\":1e-05},{\"LoadFloat\":-2.5e-300},{\"LoadFloat\":100},"
+        "{\"LoadInt\":-9223372036854775808},{\"LoadInt\":-1},{\"LoadInt\":9223372036854775807},"
+        "{\"LoadString\":\"a\\u0022b\\u005cc\"},{\"LoadString\":\"\\u0001\\u001f\x7f\"},"
+        "{\"LoadString\":\"caf\xc3\xa9\"},{\"LoadString\":\"\xff\"},"
+        "{\"LoadString\":\"tab\\u0009nl\\u000a\"},"
+        "{\"LoadBool\":true},\"Vendor\\u0022Op\",\"Return\""
+        "]}]}";
+
+    if(fwriter.ToJson() != expected) {
+        throw std::runtime_error("JSON output differs from the recorded output");
+    }
+    if(fwriter.JsonSize() != expected.size()) {
+        throw std::runtime_error("JsonSize differs from the recorded output");
+    }
+
+    // Same bytes through a file descriptor.
+    FILE *file = tmpfile();
+    if(file == nullptr) {
+        throw std::runtime_error("tmpfile failed");
+    }
+    {
+        serialization::FdSink sink(fileno(file));
+        fwriter.WriteJson(sink);
+        sink.Flush();
+    }
+    std::string from_fd(expected.size() + 1, '\0');
+    lseek(fileno(file), 0, SEEK_SET);
+    ssize_t n_read = read(fileno(file), &from_fd[0], from_fd.size());
+    fclose(file);
+    if(n_read != (ssize_t) expected.size() || from_fd.compare(0, n_read, expected) != 0) {
+        throw std::runtime_error("FdSink output differs");
+    }
+}
+
+// CallbackSink hands out at most one buffer's worth at a time, except for
+// appends larger than the buffer, which go straight to the callback.
+void test_callback_sink() {
+    std::string out;
+    std::vector<size_t> chunks;
+    std::string expected;
+
+    {
+        serialization::CallbackSink sink([&](const char *data, size_t len) {
+            out.append(data, len);
+            chunks.push_back(len);
+        });
+
+        auto append = [&](char c, size_t len) {
+            std::string s(len, c);
+            sink.Append(s.data(), s.size());
+            expected += s;
+        };
+
+        append('a', 4000);
+        // Crosses the buffer boundary: the first 4000 bytes are flushed.
+        append('b', 200);
+        // Larger than the buffer: flushes the 200, then goes straight out.
+        append('c', 5000);
+        // Fills the buffer exactly, then one more byte flushes it.
+        append('d', 4096);
+        sink.Append('e');
+        expected += 'e';
+        if(chunks != std::vector<size_t> { 4000, 200, 5000, 4096 }) {
+            throw std::runtime_error("CallbackSink: Bad chunking");
+        }
+        // The destructor flushes the rest.
+    }
+
+    if(chunks.size() != 5 || chunks.back() != 1 || out != expected) {
+        throw std::runtime_error("CallbackSink: Bad output");
+    }
+
+    // A whole function written through the sink matches ToJson.
+    assembly_writer::FunctionWriter fwriter = build_synthetic_program(1000);
+    out.clear();
+    chunks.clear();
+    {
+        serialization::CallbackSink sink([&](const char *data, size_t len) {
+            out.append(data, len);
+            chunks.push_back(len);
+        });
+        fwriter.WriteJson(sink);
+    }
+    if(out != fwriter.ToJson() || chunks.size() < 2) {
+        throw std::runtime_error("CallbackSink: JSON differs from ToJson");
+    }
+}
+
+// Forwards to the default resource and tracks the bytes outstanding.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t in_use = 0;
+    size_t peak = 0;
+
+protected:
+    void * do_allocate(size_t bytes, size_t align) override {
+        in_use += bytes;
+        peak = std::max(peak, in_use);
+        return std::pmr::get_default_resource() -> allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        in_use -= bytes;
+        std::pmr::get_default_resource() -> deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+void test_writer_memory() {
+    const int n_blocks = 12500; // 100k instructions
+
+    // Measured, not computed from sizeof: everything the writer holds
+    // (blocks, ops and pooled strings) comes from `counter`.
+    CountingResource counter;
+    {
+        assembly_writer::FunctionWriter fwriter(&counter);
+        write_synthetic_blocks(fwriter, n_blocks);
+        printf("%d instructions, %zu bytes held by the writer (%.1f bytes / instruction)\n",
+            n_blocks * 8,
+            counter.in_use,
+            (double) counter.in_use / (n_blocks * 8)
+        );
+    }
+    if(counter.in_use != 0) {
+        throw std::runtime_error("FunctionWriter leaked memory");
+    }
+
+    {
+        using namespace assembly_writer;
+        FunctionWriter fwriter(&counter);
+
+        // A block on another resource would have to be copied op by op.
+        bool rejected = false;
+        try {
+            fwriter.Write(BasicBlockWriter().LoadInt(1));
+        } catch(const std::invalid_argument& e) {
+            rejected = true;
+        }
+        if(!rejected) {
+            throw std::runtime_error("Block from another resource accepted");
+        }
+
+        // A block on the writer's resource keeps its ops and strings.
+        BasicBlockWriter bb { BasicBlockWriter::allocator_type(&counter) };
+        bb.LoadString("key_name").LoadString(std::string("temp") + "orary");
+        const BytecodeOp *ops = bb.opcodes.data();
+        const char *str = bb.opcodes[1].operands[0].string_data;
+        fwriter.Write(std::move(bb));
+        if(fwriter.Block(0).opcodes.data() != ops || fwriter.Block(0).opcodes[1].operands[0].string_data != str) {
+            throw std::runtime_error("Block on the writer's resource was copied");
+        }
+
+        // Copies are made on the writer's resource.
+        fwriter.Write(fwriter.Block(0));
+        if(fwriter.BlockCount() != 2 || fwriter.Block(1).opcodes[1].operands[0].GetString() != "temporary") {
+            throw std::runtime_error("Bad block copy");
+        }
+    }
+    if(counter.in_use != 0) {
+        throw std::runtime_error("FunctionWriter leaked adopted blocks");
+    }
+
+    bench("writer_build_100k", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            assembly_writer::FunctionWriter fwriter = build_synthetic_program(n_blocks);
+        }
+    }, 20);
+}
+
+void write_arena_program(assembly_writer::FunctionWriter& fwriter, int n_blocks) {
+    for(int i = 0; i < n_blocks; i++) {
+        fwriter.NewBlock()
+            .LoadString("key_name")
+            .GetStatic()
+            .LoadFloat(3.14159 * i)
+            .GetLocal(i % 16)
+            .IntAdd()
+            .ConditionalBranch(i + 1, 0);
+    }
+}
+
+void test_writer_arena() {
+    const int builds_per_thread = 2000;
+    unsigned int max_threads = std::thread::hardware_concurrency();
+    if(max_threads == 0) {
+        max_threads = 1;
+    }
+
+    for(unsigned int n_threads = 1; ; n_threads = std::min(n_threads * 2, max_threads)) {
+        // bench() times one thread; measure wall time across all of them.
+        auto start_time = std::chrono::steady_clock::now();
+
+        // Once the arena has grown to fit, the loop must not touch the
+        // global heap. Counts are per thread.
+        const int warmup_builds = 10;
+        std::atomic<unsigned long long> steady_news(0);
+
+        std::vector<std::thread> threads;
+        for(unsigned int t = 0; t < n_threads; t++) {
+            threads.push_back(std::thread([&]() {
+                assembly_writer::WriterArena arena;
+                assembly_writer::FunctionWriter fwriter(arena);
+                std::string output;
+                std::optional<alloc_count::Scope> scope;
+
+                for(int i = 0; i < builds_per_thread; i++) {
+                    if(i == warmup_builds) {
+                        scope.emplace();
+                    }
+                    fwriter.Reset();
+                    write_arena_program(fwriter, 100);
+                    fwriter.ToJson(output);
+                }
+                steady_news.fetch_add(scope -> Delta().news);
+            }));
+        }
+        for(auto& t : threads) {
+            t.join();
+        }
+        if(steady_news.load() != 0) {
+            throw std::runtime_error("WriterArena: Steady-state builds allocated");
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        printf("Bench: writer_arena (%u threads)\n", n_threads);
+        printf("Done. %.0f builds / sec\n", (double) builds_per_thread * n_threads / elapsed);
+
+        if(n_threads == max_threads) {
+            break;
+        }
+    }
+
+    // A limit passed to Reset() gives back what one oversized round grew
+    // the buffer to.
+    assembly_writer::WriterArena arena(1024);
+    assembly_writer::FunctionWriter fwriter(arena);
+    write_arena_program(fwriter, 100);
+    fwriter.Reset();
+    size_t grown = arena.Capacity();
+    if(grown <= 1024) {
+        throw std::runtime_error("WriterArena: Buffer did not grow");
+    }
+    write_arena_program(fwriter, 100);
+    fwriter.Reset(2048);
+    if(arena.Capacity() != 2048) {
+        throw std::runtime_error("WriterArena: Reset did not shrink the buffer");
+    }
+    fwriter.Reset(grown * 2);
+    if(arena.Capacity() != 2048) {
+        throw std::runtime_error("WriterArena: Reset limit grew the buffer");
+    }
+    write_arena_program(fwriter, 100);
+    fwriter.Reset(grown * 2);
+    if(arena.Capacity() <= 2048) {
+        throw std::runtime_error("WriterArena: Buffer did not regrow under the limit");
+    }
+}
+
+void test_runtime_pool() {
+    const int n_jobs = 20000;
+    unsigned int max_workers = std::thread::hardware_concurrency();
+    if(max_workers == 0) {
+        max_workers = 1;
+    }
+
+    for(unsigned int n_workers = 1; ; n_workers = std::min(n_workers * 2, max_workers)) {
+        ort::RuntimePool pool(n_workers, true);
+        pool.AttachFunction("sum", [](ort::Runtime&) {
+            return build_sum_tester();
+        });
+        pool.AttachFunction("set_ret", [](ort::Runtime&) {
+            return ort::Function::LoadNative([]() {
+                return ort::Value::Null();
+            });
+        });
+        pool.AttachFunction("entry", [](ort::Runtime&) {
+            ort::Function f = build_call_tester();
+            f.EnableOptimization();
+            return f;
+        });
+        pool.Start();
+
+        std::atomic<long long> total(0);
+        auto start_time = std::chrono::steady_clock::now();
+        for(int i = 0; i < n_jobs; i++) {
+            pool.Invoke("sum", { ort::Value::FromInt(0), ort::Value::FromInt(10000) }, [&](ort::Runtime&, ort::Value ret) {
+                total.fetch_add(ret.ExtractI64(), std::memory_order_relaxed);
+            });
+        }
+        pool.WaitIdle();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        printf("Bench: pool_sum (%u workers)\n", n_workers);
+        printf("Done. %.0f jobs / sec\n", n_jobs / elapsed);
+
+        // 1000 calls per job, so dispatch cost stays out of the way.
+        start_time = std::chrono::steady_clock::now();
+        for(int i = 0; i < n_jobs; i++) {
+            pool.Post([](ort::Runtime& rt) {
+                ort::Value entry = rt.ResolveStatic("entry").Get();
+                for(int j = 0; j < 1000; j++) {
+                    rt.Invoke(entry);
+                }
+            });
+        }
+        pool.WaitIdle();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        printf("Bench: pool_invoke (%u workers)\n", n_workers);
+        printf("Done. %.0f invokes / sec\n", n_jobs * 1000.0 / elapsed);
+
+        if(pool.FailedJobs() != 0 || total.load() != (long long) n_jobs * 10000 * 10001 / 2) {
+            throw std::runtime_error("RuntimePool: Bad results");
+        }
+
+        if(n_workers == max_workers) {
+            break;
+        }
+    }
+}
+
+// Build with -DHX_ORT_ENABLE_STATS to exercise the counters.
+void test_function_stats() {
+    ort::Runtime rt;
+    ort::Function f = ort::Function::LoadNative<long long (long long)>([](long long x) {
+        return x + 1;
+    });
+    rt.AttachFunction("stats_target", f);
+    ort::Value target = rt.GetStaticObject("stats_target");
+
+    // Calls into stats_target made from inside another function, as
+    // bytecode would make them, are counted too.
+    ort::Function outer = ort::Function::LoadNative<long long (long long)>([&](long long x) {
+        return rt.Invoke(target, ort::Value::FromInt(x)).ExtractI64();
+    });
+    rt.AttachFunction("stats_outer", outer);
+    ort::Value outer_target = rt.GetStaticObject("stats_outer");
+
+    // Bytecode functions are timed by host calls through a static slot.
+    // Slots resolved before the attach pick the stats up too.
+    ort::StaticSlot sum_slot = rt.ResolveStatic("stats_sum");
+    ort::Function sum = build_sum_tester();
+    rt.AttachFunction("stats_sum", sum);
+    ort::StaticSlot target_slot = rt.ResolveStatic("stats_target");
+
+    const int n_direct = 1000, n_nested = 500, n_bytecode = 200;
+    for(int i = 0; i < n_direct; i++) {
+        rt.Invoke(target, ort::Value::FromInt(i));
+    }
+    for(int i = 0; i < n_nested; i++) {
+        rt.Invoke(outer_target, ort::Value::FromInt(i));
+    }
+    for(int i = 0; i < n_bytecode; i++) {
+        rt.Invoke(sum_slot, ort::Value::FromInt(0), ort::Value::FromInt(i));
+        // Natives are timed once, in the trampoline, not again by the slot.
+        rt.Invoke(target_slot, ort::Value::FromInt(i));
+    }
+
+    std::vector<ort::FunctionStatsSnapshot> snapshot = rt.Snapshot();
+#ifdef HX_ORT_ENABLE_STATS
+    if(snapshot.size() != 3
+        || snapshot[0].key != "stats_target" || snapshot[0].calls != n_direct + n_nested + n_bytecode
+        || snapshot[1].key != "stats_outer" || snapshot[1].calls != n_nested
+        || snapshot[2].key != "stats_sum" || snapshot[2].calls != n_bytecode) {
+        throw std::runtime_error("Bad function stats");
+    }
+#else
+    if(!snapshot.empty()) {
+        throw std::runtime_error("Function stats collected while disabled");
+    }
+#endif
+
+    bench("invoke_with_stats", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.Invoke(target, ort::Value::FromInt(i));
+        }
+    });
+
+#ifdef HX_ORT_ENABLE_STATS
+    ort::FunctionStatsSnapshot s = rt.Snapshot()[0];
+    printf("%s: %llu calls, %.1f ns avg, p50 >= %llu ns, p99 >= %llu ns\n",
+        s.key.c_str(),
+        s.calls,
+        (double) s.total_ns / s.calls,
+        s.Percentile(0.5),
+        s.Percentile(0.99)
+    );
+#endif
+}
+
+// Build with -DHX_ORT_ENABLE_PROFILER to get folded stacks; comparing the
+// bench numbers of the two builds gives the profiler's overhead.
+void test_profiler() {
+    ort::Runtime rt;
+    ort::Profiler::NameType<Adder>("Adder");
+
+    ort::Function inner = ort::Function::LoadNative<long long (long long)>([](long long x) {
+        return x * 2;
+    });
+    rt.AttachFunction("inner", inner);
+    ort::Value inner_fn = rt.GetStaticObject("inner");
+
+    ort::ObjectProxy proxy(new Adder());
+    ort::Value adder = proxy.Pin(rt);
+
+    // VM -> native -> VM re-entry -> native, plus a proxy call.
+    ort::Function outer = ort::Function::LoadNative<long long (long long)>([&](long long x) {
+        long long doubled = rt.Invoke(inner_fn, ort::Value::FromInt(x)).ExtractI64();
+        return rt.Invoke(adder, ort::Value::FromInt(doubled), ort::Value::FromInt(1)).ExtractI64();
+    });
+    rt.AttachFunction("outer", outer);
+    ort::Value outer_fn = rt.GetStaticObject("outer");
+
+    // The profiler must put back whatever SIGPROF handler it displaced.
+    struct sigaction own_action, original_action, after_stop;
+    memset(&own_action, 0, sizeof(own_action));
+    own_action.sa_handler = [](int) {};
+    sigemptyset(&own_action.sa_mask);
+    sigaction(SIGPROF, &own_action, &original_action);
+
+    ort::Profiler::Reset();
+    ort::Profiler::Start(100);
+    long long ret = 0;
+    bench("profiler_reentry", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ret += rt.Invoke(outer_fn, ort::Value::FromInt(i)).ExtractI64();
+        }
+    });
+    ort::Profiler::Stop();
+
+    sigaction(SIGPROF, &original_action, &after_stop);
+    if(after_stop.sa_handler != own_action.sa_handler) {
+        throw std::runtime_error("Profiler: SIGPROF handler not restored");
+    }
+
+    std::string folded = ort::Profiler::Folded();
+#ifdef HX_ORT_ENABLE_PROFILER
+    printf("%s", folded.c_str());
+    unsigned long long outer_calls = 0, adder_calls = 0;
+    for(const ort::ProfileEntry& e : ort::Profiler::Report()) {
+        printf("%s: %llu calls, %llu ns total, %llu ns self\n", e.name.c_str(), e.calls, e.total_ns, e.self_ns);
+        if(e.name == "outer") outer_calls = e.calls;
+        if(e.name == "Adder.call") adder_calls = e.calls;
+    }
+    if(outer_calls == 0 || adder_calls != outer_calls) {
+        throw std::runtime_error("Profiler: Missing nested frame");
+    }
+    ort::Profiler::Reset();
+    if(!ort::Profiler::Folded().empty()) {
+        throw std::runtime_error("Profiler: Data left after Reset");
+    }
+#else
+    if(!folded.empty()) {
+        throw std::runtime_error("Profiler: Output while disabled");
+    }
+#endif
+}
+
+// ABI calls made per wrapper. Counts are exact, so this doubles as a
+// check that Type() + ExtractI64() stays at one call each.
+void test_ffi_trace() {
+    ort::FfiTrace::Reset();
+
+    long long sum = 0;
+    for(int i = 0; i < 1000; i++) {
+        ort::Value v = ort::Value::FromInt(i);
+        if(v.Type() == ort::ValueType::Int) {
+            sum += v.ExtractI64();
+        }
+    }
+
+    std::vector<ort::FfiTraceEntry> entries = ort::FfiTrace::Report();
+#ifdef HX_ORT_TRACE_FFI
+    ort::FfiTrace::Dump(stdout);
+    auto calls = [&](const char *entry, const char *caller) -> unsigned long long {
+        for(const ort::FfiTraceEntry& e : entries) {
+            if(e.entry == entry && e.caller == caller) return e.calls;
+        }
+        return 0;
+    };
+    if(calls("hexagon_ort_value_create_from_i64", "Value::FromInt") != 1000
+        || calls("hexagon_ort_value_get_type", "Value::Type") != 1000
+        || calls("hexagon_ort_value_read_i64", "Value::ExtractI64") != 1000) {
+        throw std::runtime_error("FfiTrace: Unexpected call counts");
+    }
+#else
+    if(!entries.empty()) {
+        throw std::runtime_error("FfiTrace: Output while disabled");
+    }
+#endif
+    if(sum != 499500) {
+        throw std::runtime_error("FfiTrace: Bad sum");
+    }
+}
+
+void print_latency(const char *name, std::vector<unsigned long long>& samples) {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        return samples[std::min(samples.size() - 1, (size_t) (q * samples.size()))];
+    };
+    printf("Bench: %s\n", name);
+    printf("Done. p50 %llu ns, p99 %llu ns, p99.9 %llu ns\n", at(0.5), at(0.99), at(0.999));
+}
+
+#ifdef HX_ORT_HAS_COROUTINES
+// Minimal eagerly-started coroutine for the InvokeAsync test.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+DetachedTask await_invoke(ort::Runtime& rt, const ort::Value& f, std::atomic<long long>& out) {
+    std::vector<ort::Value> args = { ort::Value::FromInt(20), ort::Value::FromInt(22) };
+    ort::Value ret = co_await rt.InvokeAsync(f, args);
+    out.store(ret.ExtractI64(), std::memory_order_release);
+}
+#endif
+
+// End-to-end latency of a call made from another thread: InvokeAsync
+// against the usual mutex + condition variable handoff.
+void test_invoke_async() {
+    const int n = 100000;
+    auto add = []() {
+        return ort::Function::LoadNative<long long (long long, long long)>([](long long a, long long b) {
+            return a + b;
+        });
+    };
+    std::vector<unsigned long long> samples;
+    samples.reserve(n);
+
+    {
+        ort::Runtime rt;
+        ort::Function f = add();
+        rt.AttachFunction("add", f);
+        ort::Value target = rt.GetStaticObject("add");
+
+        std::atomic<bool> done(false);
+        long long ret = 0;
+        for(int i = 0; i < n; i++) {
+            auto start_time = std::chrono::steady_clock::now();
+            rt.InvokeAsync(target, { ort::Value::FromInt(i), ort::Value::FromInt(1) }, [&](ort::Value v) {
+                ret = v.ExtractI64();
+                done.store(true, std::memory_order_release);
+            });
+            while(!done.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            done.store(false, std::memory_order_relaxed);
+            samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count());
+            if(ret != i + 1) {
+                throw std::runtime_error("InvokeAsync: Bad result");
+            }
+        }
+        print_latency("invoke_async", samples);
+
+        // Submitting from `done` must not wait for ring space the executor
+        // itself would have to free.
+        const int n_nested = 4096;
+        std::atomic<int> n_nested_done(0);
+        rt.InvokeAsync(target, { ort::Value::FromInt(0), ort::Value::FromInt(0) }, [&](ort::Value) {
+            for(int i = 0; i < n_nested; i++) {
+                rt.InvokeAsync(target, { ort::Value::FromInt(i), ort::Value::FromInt(1) }, [&](ort::Value) {
+                    n_nested_done.fetch_add(1, std::memory_order_release);
+                });
+            }
+        });
+        while(n_nested_done.load(std::memory_order_acquire) != n_nested) {
+            std::this_thread::yield();
+        }
+
+        // Synchronous calls from this thread now run on the executor, in
+        // order with the queued calls.
+        std::atomic<long long> last_async(0);
+        rt.InvokeAsync(target, { ort::Value::FromInt(1), ort::Value::FromInt(1) }, [&](ort::Value v) {
+            last_async.store(v.ExtractI64(), std::memory_order_release);
+        });
+        if(rt.Invoke(target, ort::Value::FromInt(2), ort::Value::FromInt(3)).ExtractI64() != 5
+            || last_async.load(std::memory_order_acquire) != 2) {
+            throw std::runtime_error("InvokeAsync: Bad routed Invoke");
+        }
+        ort::Value batch_args[] = { ort::Value::FromInt(1), ort::Value::FromInt(2), ort::Value::FromInt(3), ort::Value::FromInt(4) };
+        ort::Value batch_results[2] = { ort::Value::FromInt(0), ort::Value::FromInt(0) };
+        if(rt.InvokeBatch(target, batch_args, 2, 2, batch_results) != 0
+            || batch_results[0].ExtractI64() != 3 || batch_results[1].ExtractI64() != 7) {
+            throw std::runtime_error("InvokeAsync: Bad routed InvokeBatch");
+        }
+
+        // Everything else is off limits from this thread.
+        bool rejected = false;
+        try {
+            rt.GetStaticObject("add");
+        } catch(const std::logic_error&) {
+            rejected = true;
+        }
+        if(!rejected) {
+            throw std::runtime_error("InvokeAsync: GetStaticObject allowed off the executor thread");
+        }
+
+        // More arguments than fit inline in the queue.
+        std::vector<ort::Value> many;
+        for(int i = 0; i < 12; i++) {
+            many.push_back(ort::Value::FromInt(i));
+        }
+        std::atomic<bool> many_done(false);
+        rt.InvokeAsync(target, many, [&](ort::Value v) {
+            if(v.ExtractI64() != 1) {
+                throw std::runtime_error("InvokeAsync: Bad spilled arguments");
+            }
+            many_done.store(true, std::memory_order_release);
+        });
+        while(!many_done.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+#ifdef HX_ORT_HAS_COROUTINES
+        std::atomic<long long> co_ret(0);
+        await_invoke(rt, target, co_ret);
+        while(co_ret.load(std::memory_order_acquire) == 0) {
+            std::this_thread::yield();
+        }
+        if(co_ret.load() != 42) {
+            throw std::runtime_error("InvokeAsync: Bad coroutine result");
+        }
+#endif
+    }
+
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        std::function<void (ort::Runtime&, const ort::Value&)> job;
+        bool stop = false, finished = false;
+
+        std::thread worker([&]() {
+            ort::Runtime rt;
+            ort::Function f = add();
+            rt.AttachFunction("add", f);
+            // Resolved once, as the InvokeAsync side does.
+            ort::Value target = rt.GetStaticObject("add");
+
+            std::unique_lock<std::mutex> lk(m);
+            for(;;) {
+                cv.wait(lk, [&]() { return job || stop; });
+                if(stop) {
+                    break;
+                }
+                job(rt, target);
+                job = nullptr;
+                finished = true;
+                cv.notify_all();
+            }
+        });
+
+        samples.clear();
+        long long ret = 0;
+        for(int i = 0; i < n; i++) {
+            auto start_time = std::chrono::steady_clock::now();
+            {
+                std::unique_lock<std::mutex> lk(m);
+                job = [&, i](ort::Runtime& rt, const ort::Value& target) {
+                    ret = rt.Invoke(target, ort::Value::FromInt(i), ort::Value::FromInt(1)).ExtractI64();
+                };
+                cv.notify_all();
+                cv.wait(lk, [&]() { return finished; });
+                finished = false;
+            }
+            samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count());
+            if(ret != i + 1) {
+                throw std::runtime_error("Mutex handoff: Bad result");
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lg(m);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+        print_latency("invoke_mutex_handoff", samples);
+    }
+}
+
+template<size_t... I>
+void bench_invoke_args(ort::Runtime& rt, ort::Value target, std::index_sequence<I...>) {
+    char name[32];
+    snprintf(name, sizeof(name), "invoke_args_%zu", sizeof...(I));
+
+    bench(name, [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.Invoke(target, ort::Value::FromInt((int) I)...);
+        }
+    });
+}
+
+template<size_t... N>
+void bench_invoke_arg_counts(ort::Runtime& rt, ort::Value target, std::index_sequence<N...>) {
+    (bench_invoke_args(rt, target, std::make_index_sequence<N>()), ...);
+}
+
+void test_invoke_args() {
+    ort::Runtime rt;
+
+    ort::Function nop = ort::Function::LoadNative([]() {
+        return ort::Value::Null();
+    });
+    rt.AttachFunction("nop", nop);
+    ort::Value target = rt.GetStaticObject("nop");
+
+    bench_invoke_arg_counts(rt, target, std::make_index_sequence<17>());
+}
+
+void test_invoke_batch() {
+    const size_t n_rows = 1000;
+
+    ort::Runtime rt;
+
+    ort::Function add = ort::Function::LoadNative([&rt]() {
+        return ort::Value::FromInt(rt.GetArgument(0).ExtractI64() + rt.GetArgument(1).ExtractI64());
+    });
+    rt.AttachFunction("add", add);
+    ort::Value target = rt.GetStaticObject("add");
+
+    std::vector<ort::Value> args;
+    for(size_t i = 0; i < n_rows; i++) {
+        args.push_back(ort::Value::FromInt(i));
+        args.push_back(ort::Value::FromInt(1));
+    }
+    std::vector<ort::Value> results(n_rows, ort::Value::Null());
+    std::unique_ptr<bool[]> row_errors(new bool[n_rows]);
+
+    bench("invoke_loop", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            for(size_t row = 0; row < n_rows; row++) {
+                results[row] = rt.Invoke(target, &args[row * 2], 2);
+            }
+        }
+    }, 1000);
+
+    bench("invoke_batch", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.InvokeBatch(target, args.data(), n_rows, 2, results.data(), row_errors.get());
+        }
+    }, 1000);
+
+    for(size_t row = 0; row < n_rows; row++) {
+        if(row_errors[row] || results[row].ExtractI64() != (long long) row + 1) {
+            throw std::runtime_error("Bad batch result");
+        }
+    }
+
+    // Failures are attributed to their own row.
+    ort::Function odd_fails = ort::Function::LoadNative<long long (long long)>([](long long x) -> long long {
+        if(x % 2) {
+            throw std::runtime_error("odd");
+        }
+        return x;
+    });
+    rt.AttachFunction("odd_fails", odd_fails);
+    size_t n_failed = rt.InvokeBatch(rt.GetStaticObject("odd_fails"), args.data(), n_rows, 2, results.data(), row_errors.get());
+    for(size_t row = 0; row < n_rows; row++) {
+        if(row_errors[row] != (row % 2 == 1)) {
+            throw std::runtime_error("Bad batch error attribution");
+        }
+    }
+    if(n_failed != n_rows / 2) {
+        throw std::runtime_error("Bad batch failure count");
+    }
+    for(size_t row = 0; row < n_rows; row++) {
+        if(row % 2 == 1 ? !results[row].IsNull() : results[row].ExtractI64() != (long long) row) {
+            throw std::runtime_error("Bad batch result after failure");
+        }
+    }
+}
+
+void test_native_typed() {
+    ort::Runtime rt;
+
+    ort::Function legacy = ort::Function::LoadNative([&rt]() {
+        return ort::Value::FromInt(rt.GetArgument(0).ExtractI64() + rt.GetArgument(1).ExtractI64());
+    });
+    ort::Function typed = ort::Function::LoadNative<long long (long long, long long)>([](long long a, long long b) {
+        return a + b;
+    });
+    rt.AttachFunction("legacy_add", legacy);
+    rt.AttachFunction("typed_add", typed);
+
+    ort::Value legacy_target = rt.GetStaticObject("legacy_add");
+    ort::Value typed_target = rt.GetStaticObject("typed_add");
+    ort::Value a = ort::Value::FromInt(1), b = ort::Value::FromInt(2);
+
+    bench("native_legacy", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.Invoke(legacy_target, a, b);
+        }
+    });
+    bench("native_typed", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.Invoke(typed_target, a, b);
+        }
+    });
+
+    if(rt.Invoke(typed_target, a, b).ExtractI64() != 3) {
+        throw std::runtime_error("Bad typed native result");
+    }
+
+    // Integers that do not fit the parameter type are rejected, not
+    // truncated.
+    int seen = 0;
+    ort::Function narrow = ort::Function::LoadNative<void (int, unsigned char)>([&seen](int x, unsigned char y) {
+        seen = x + y;
+    });
+    rt.AttachFunction("narrow", narrow);
+    ort::Value narrow_target = rt.GetStaticObject("narrow");
+
+    rt.Invoke(narrow_target, ort::Value::FromInt(-5), ort::Value::FromInt(255));
+    if(seen != 250) {
+        throw std::runtime_error("In-range narrow arguments rejected");
+    }
+    const long long out_of_range[][2] = { { 1LL << 40, 0 }, { 0, 256 }, { 0, -1 }, { (long long) INT_MIN - 1, 0 } };
+    for(const long long *args : out_of_range) {
+        seen = -1;
+        ort::ErrorSlot::Current().Clear();
+        rt.Invoke(narrow_target, ort::Value::FromInt(args[0]), ort::Value::FromInt(args[1]));
+        if(seen != -1 || strstr(ort::LastNativeError(), "out of range") == nullptr) {
+            throw std::runtime_error("Out-of-range narrow argument accepted");
+        }
+    }
+}
+
+template<int N>
+class WideObject : public ort::FieldDispatchedObject<WideObject<N>> {
+public:
+    static std::vector<std::string>& Names() {
+        static std::vector<std::string> names;
+        if(names.empty()) {
+            for(int i = 0; i < N; i++) {
+                names.push_back("field_" + std::to_string(i));
+            }
+        }
+        return names;
+    }
+
+    static void DeclareFields(ort::FieldTable<WideObject>& fields) {
+        for(auto& name : Names()) {
+            fields.Field(name, &WideObject::Get);
+        }
+    }
+
+    ort::Value Get() {
+        return ort::Value::FromInt(N);
+    }
+
+    // What subclasses typically do without a table.
+    ort::Value GetFieldByStrcmp(const char *name) {
+        for(auto& field : Names()) {
+            if(strcmp(field.c_str(), name) == 0) {
+                return Get();
+            }
+        }
+        throw std::runtime_error("GetField: Unknown field");
+    }
+};
+
+template<int N>
+void bench_field_dispatch() {
+    WideObject<N> *obj = new WideObject<N>();
+    ort::ObjectProxy proxy(obj);
+    const char *last = WideObject<N>::Names().back().c_str();
+    char name[48];
+
+    snprintf(name, sizeof(name), "field_strcmp_%d", N);
+    bench(name, [&](int n) {
+        for(int i = 0; i < n; i++) {
+            obj -> GetFieldByStrcmp(last);
+        }
+    });
+
+    snprintf(name, sizeof(name), "field_table_%d", N);
+    bench(name, [&](int n) {
+        for(int i = 0; i < n; i++) {
+            obj -> GetField(last);
+        }
+    });
+}
+
+// One distinct getter per field, so lookups can be checked by identity.
+class LabeledObject : public ort::ProxiedObject {
+public:
+    template<int I>
+    ort::Value Get() {
+        return ort::Value::FromInt(I);
+    }
+};
+
+template<int... I>
+void declare_labeled(ort::FieldTable<LabeledObject>& fields, std::vector<std::pair<std::string, ort::FieldTable<LabeledObject>::Getter>>& expected, std::integer_sequence<int, I...>) {
+    (expected.push_back(std::make_pair("field_" + std::to_string(I), &LabeledObject::Get<I>)), ...);
+    for(auto& e : expected) {
+        fields.Field(e.first, e.second);
+    }
+}
+
+// Reaches into FieldTable's internals, which it befriends.
+namespace hexagon {
+namespace ort {
+struct FieldTableTest {
+    template<class T>
+    static const char * SlotOwner(const FieldTable<T>& fields, const char *name) {
+        return fields.SlotOwner(name);
+    }
+
+    // What Build() falls back to when no seed yields a perfect hash.
+    template<class T>
+    static void BuildSorted(FieldTable<T>& fields) {
+        fields.build_sorted();
+    }
+};
+} // namespace ort
+} // namespace hexagon
+
+void test_field_table() {
+    ort::FieldTable<LabeledObject> fields;
+    std::vector<std::pair<std::string, ort::FieldTable<LabeledObject>::Getter>> expected;
+    declare_labeled(fields, expected, std::make_integer_sequence<int, 40>());
+    fields.Build();
+
+    for(auto& e : expected) {
+        if(fields.Find(e.first.c_str()) != e.second) {
+            throw std::runtime_error("FieldTable: " + e.first + " does not resolve to its getter");
+        }
+    }
+
+    // Prefixes, extensions and near misses of declared names.
+    const char *near[] = { "", "field_", "field_1x", "field_01", "field_40", "Field_0", "field_0 " };
+    for(const char *name : near) {
+        if(fields.Find(name) != nullptr) {
+            throw std::runtime_error(std::string("FieldTable: Unknown name resolved: ") + name);
+        }
+    }
+
+    // Unknown names that land on an occupied slot are only rejected by
+    // the final comparison; make sure some of those are covered.
+    int n_shared = 0;
+    for(int i = 0; i < 1000; i++) {
+        std::string name = "unknown_" + std::to_string(i);
+        if(ort::FieldTableTest::SlotOwner(fields, name.c_str()) != nullptr) {
+            n_shared++;
+        }
+        if(fields.Find(name.c_str()) != nullptr) {
+            throw std::runtime_error("FieldTable: Unknown name resolved: " + name);
+        }
+    }
+    if(n_shared == 0) {
+        throw std::runtime_error("FieldTable: No unknown name shared a slot");
+    }
+
+    // The sorted fallback resolves the same names.
+    ort::FieldTable<LabeledObject> sorted;
+    expected.clear();
+    declare_labeled(sorted, expected, std::make_integer_sequence<int, 40>());
+    ort::FieldTableTest::BuildSorted(sorted);
+    for(auto& e : expected) {
+        if(sorted.Find(e.first.c_str()) != e.second) {
+            throw std::runtime_error("FieldTable (sorted): " + e.first + " does not resolve to its getter");
+        }
+    }
+    for(const char *name : near) {
+        if(sorted.Find(name) != nullptr) {
+            throw std::runtime_error(std::string("FieldTable (sorted): Unknown name resolved: ") + name);
+        }
+    }
+    if(ort::FieldTableTest::SlotOwner(sorted, "field_0") != nullptr) {
+        throw std::runtime_error("FieldTable (sorted): Hash slots left behind");
+    }
+}
+
+void test_field_dispatch() {
+    bench_field_dispatch<4>();
+    bench_field_dispatch<32>();
+    bench_field_dispatch<256>();
+}
+
+// Handles one field itself and leaves the rest to the default.
+class FallbackObject : public ort::ProxiedObject {
+public:
+    virtual ort::Value GetField(const char *name) override {
+        if(strcmp(name, "x") == 0) {
+            return ort::Value::FromInt(1);
+        }
+        return ort::ProxiedObject::GetField(name);
+    }
+};
+
+// Reports misses by throwing, as subclasses written before TryGetField do.
+class ThrowingObject : public ort::ProxiedObject {
+public:
+    virtual ort::Value GetField(const char *) override {
+        throw std::runtime_error("GetField: Unknown field");
+    }
+};
+
+// Asks the default first and supplies its own value on a miss.
+class RecoveringObject : public ort::ProxiedObject {
+public:
+    virtual ort::Value GetField(const char *name) override {
+        try {
+            return ort::ProxiedObject::GetField(name);
+        } catch(const ort::FieldNotFound&) {
+            return ort::Value::FromInt(2);
+        }
+    }
+};
+
+void test_field_miss() {
+    // Adder only has the default GetField.
+    Adder *legacy = new Adder();
+    ort::ObjectProxy legacy_proxy(legacy);
+    FallbackObject *fallback = new FallbackObject();
+    ort::ObjectProxy fallback_proxy(fallback);
+    ThrowingObject *throwing = new ThrowingObject();
+    ort::ObjectProxy throwing_proxy(throwing);
+    WideObject<4> *dispatched = new WideObject<4>();
+    ort::ObjectProxy dispatched_proxy(dispatched);
+    RecoveringObject *recovering = new RecoveringObject();
+    ort::ObjectProxy recovering_proxy(recovering);
+
+    ort::Value out = ort::Value::Null();
+
+    if(legacy -> TryGetField("missing", out) != ort::Status::NotFound) {
+        throw std::runtime_error("Default GetField should report a miss");
+    }
+    if(fallback -> TryGetField("x", out) != ort::Status::Ok || out.ExtractI64() != 1) {
+        throw std::runtime_error("Fallback object lost its own field");
+    }
+    if(fallback -> TryGetField("missing", out) != ort::Status::NotFound) {
+        throw std::runtime_error("Fallback to the default GetField should report a miss");
+    }
+    if(throwing -> TryGetField("missing", out) != ort::Status::Error) {
+        throw std::runtime_error("Throwing GetField should report an error");
+    }
+    if(recovering -> TryGetField("missing", out) != ort::Status::Ok || out.ExtractI64() != 2) {
+        throw std::runtime_error("Value supplied after a default miss was lost");
+    }
+
+    // Direct calls keep throwing.
+    bool threw = false;
+    try {
+        legacy -> GetField("missing");
+    } catch(const ort::FieldNotFound& e) {
+        threw = true;
+    }
+    if(!threw) {
+        throw std::runtime_error("Default GetField should throw when called directly");
+    }
+
+    bench("field_miss_throwing", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            throwing -> TryGetField("missing", out);
+        }
+    }, 100000);
+
+    bench("field_miss_default", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            if(legacy -> TryGetField("missing", out) != ort::Status::NotFound) {
+                throw std::runtime_error("Expected a miss");
+            }
+        }
+    });
+
+    bench("field_miss_status", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            if(dispatched -> TryGetField("missing", out) != ort::Status::NotFound) {
+                throw std::runtime_error("Expected a miss");
+            }
+        }
+    });
+    printf("%s\n", ort::LastNativeError());
+}
+
+void test_string_read() {
+    ort::Runtime rt;
+    ort::Value val = ort::Value::FromString("a string long enough to skip the small string buffer", rt);
+    std::string buffer;
+    size_t total = 0;
+
+    struct {
+        const char *name;
+        std::function<void ()> read;
+    } cases[] = {
+        { "string_to_string", [&]() { total += val.ToString(rt).size(); } },
+        { "string_read_owned", [&]() { total += val.ReadString(rt).size(); } },
+        { "string_read_into", [&]() { total += val.ReadStringInto(rt, buffer); } },
+    };
+
+    for(auto& c : cases) {
+        bench(c.name, [&](int n) {
+            for(int i = 0; i < n; i++) {
+                c.read();
+            }
+        });
+    }
+    printf("%zu\n", total);
+}
+
+void test_string_intern() {
+    ort::Runtime rt;
+    std::string_view key = "status_code";
+
+    bench("string_create", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ort::Value::FromString(key, rt);
+        }
+    });
+
+    rt.Intern(key);
+    bench("string_intern", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            rt.Intern(key);
+        }
+    });
+
+    if(rt.Intern(key).ToString(rt) != key) {
+        throw std::runtime_error("Bad interned string");
+    }
+
+    bool rejected = false;
+    try {
+        ort::Value::FromString(std::string("a\0b", 3), rt);
+    } catch(const std::invalid_argument& e) {
+        rejected = true;
+    }
+    if(!rejected) {
+        throw std::runtime_error("FromString: Embedded NUL accepted");
+    }
+}
+
+// Binary bytecode is storage-only: no backend loads it, so the cost of
+// using it is a transcode back to JSON on top of the JSON load.
+void bench_encoding(const char *name, assembly_writer::FunctionWriter& fwriter, int n) {
+    std::string json = fwriter.ToJson();
+    std::string binary = fwriter.ToBinary();
+
+    printf("%s: json %zu bytes, binary %zu bytes\n", name, json.size(), binary.size());
+
+    std::string transcoded;
+    serialization::StringSink transcoded_sink(transcoded);
+    assembly_writer::TranscodeBinaryToJson((const unsigned char *) binary.data(), binary.size(), transcoded_sink);
+    if(transcoded != json) {
+        throw std::runtime_error("Binary bytecode does not transcode back to the same JSON");
+    }
+
+    bench((std::string("load_json_") + name).c_str(), [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ort::Function::LoadVirtual("json", (const unsigned char *) json.data(), json.size());
+        }
+    }, n);
+    bench((std::string("binary_to_json_") + name).c_str(), [&](int n) {
+        for(int i = 0; i < n; i++) {
+            transcoded.clear();
+            assembly_writer::TranscodeBinaryToJson((const unsigned char *) binary.data(), binary.size(), transcoded_sink);
+        }
+    }, n);
+}
+
+void test_static_slot() {
+    ort::Runtime rt;
+
+    // Resolved before anything is attached under the key.
+    ort::StaticSlot slot = rt.ResolveStatic("slot_target");
+    if(slot) {
+        throw std::runtime_error("Static slot filled before attach");
+    }
+
+    ort::Function target = ort::Function::LoadNative<long long ()>([]() {
+        return 42LL;
+    });
+    rt.AttachFunction("slot_target", target);
+
+    if(!slot || rt.Invoke(slot).ExtractI64() != 42) {
+        throw std::runtime_error("Static slot not refreshed by AttachFunction");
+    }
+
+    rt.RefreshStaticSlots();
+    if(!slot || rt.Invoke(rt.ResolveStatic("slot_target")).ExtractI64() != 42) {
+        throw std::runtime_error("Static slot lost by RefreshStaticSlots");
+    }
+
+    long long ret = 0;
+    bench("static_lookup", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ret += rt.Invoke(rt.GetStaticObject("slot_target")).ExtractI64();
+        }
+    });
+    bench("static_slot", [&](int n) {
+        for(int i = 0; i < n; i++) {
+            ret += rt.Invoke(slot).ExtractI64();
+        }
+    });
+    printf("%lld\n", ret);
+}
+
+// Per-type dispatch cost: a type query followed by a typed read, against
+// a single Visit.
+void test_value_decode() {
+    ort::Runtime rt;
+
+    struct Case {
+        const char *name;
+        ort::Value v;
+    };
+    Case cases[] = {
+        { "int", ort::Value::FromInt(42) },
+        { "float", ort::Value::FromFloat(1.5) },
+        { "bool", ort::Value::FromBool(true) },
+        { "null", ort::Value::Null() },
+    };
+
+    for(const Case& c : cases) {
+        double acc = 0;
+        std::string name = std::string("decode_type_extract_") + c.name;
+        bench(name.c_str(), [&](int n) {
+            for(int i = 0; i < n; i++) {
+                switch(c.v.Type()) {
+                    case ort::ValueType::Int: acc += c.v.ExtractI64(); break;
+                    case ort::ValueType::Float: acc += c.v.ExtractF64(); break;
+                    case ort::ValueType::Bool: acc += c.v.ExtractBool(); break;
+                    default: acc += 1; break;
+                }
+            }
+        });
+
+        double acc_visit = 0;
+        name = std::string("decode_visit_") + c.name;
+        bench(name.c_str(), [&](int n) {
+            for(int i = 0; i < n; i++) {
+                acc_visit += c.v.Visit([](auto x) -> double {
+                    if constexpr (std::is_arithmetic<decltype(x)>::value) {
+                        return (double) x;
+                    } else {
+                        return 1;
+                    }
+                });
+            }
+        });
+
+        if(acc != acc_visit) {
+            throw std::runtime_error("Visit disagrees with Type/Extract");
+        }
+    }
+
+    if(cases[0].v.ToF64() != 42.0 || cases[1].v.ToI64() != 1) {
+        throw std::runtime_error("Bad numeric conversion");
+    }
+
+#ifdef HX_ORT_TRACE_FFI
+    // Decode is a type query plus at most one typed read.
+    for(const Case& c : cases) {
+        ort::FfiTrace::Reset();
+        c.v.Decode();
+        unsigned long long crossings = 0;
+        for(const ort::FfiTraceEntry& e : ort::FfiTrace::Report()) {
+            crossings += e.calls;
+        }
+        if(crossings != (c.v.Type() == ort::ValueType::Null ? 1 : 2)) {
+            throw std::runtime_error("Decode: Unexpected number of ABI calls");
+        }
+    }
+#endif
+}
+
+void test_encoding() {
+    assembly_writer::FunctionWriter call_tester = write_call_tester();
+    assembly_writer::FunctionWriter sum_tester = write_sum_tester();
+    assembly_writer::FunctionWriter synthetic = build_synthetic_program(10000);
+
+    bench_encoding("call_tester", call_tester, 100000);
+    bench_encoding("sum_tester", sum_tester, 100000);
+    bench_encoding("synthetic", synthetic, 10);
+
+    // Custom opcode names go through the string table.
+    assembly_writer::FunctionWriter custom;
+    assembly_writer::BasicBlockWriter& bb = custom.NewBlock();
+    bb.Write(assembly_writer::BytecodeOp("VendorOp", assembly_writer::Operand::String("x")));
+    bb.Write(assembly_writer::BytecodeOp("VendorOp"));
+    bb.Write(assembly_writer::BytecodeOp("Return"));
+    bench_encoding("custom", custom, 1);
+
+    std::string truncated = custom.ToBinary();
+    truncated.pop_back();
+    bool rejected = false;
+    try {
+        std::string out;
+        serialization::StringSink sink(out);
+        assembly_writer::TranscodeBinaryToJson((const unsigned char *) truncated.data(), truncated.size(), sink);
+    } catch(const std::runtime_error&) {
+        rejected = true;
+    }
+    if(!rejected) {
+        throw std::runtime_error("Truncated binary bytecode accepted");
+    }
+}
+
+// Baselines round-trip through WriteJson/ReadJson, and a damaged file is
+// rejected instead of being read as fewer results.
+void test_bench_json() {
+    const char *path = "bench_roundtrip.json";
+    auto write_file = [&](const std::string& text) {
+        FILE *f = fopen(path, "wb");
+        if(!f) {
+            throw std::runtime_error("Unable to write test file");
+        }
+        fwrite(text.data(), 1, text.size(), f);
+        fclose(f);
+    };
+    auto rejected = [&](const std::string& text) {
+        write_file(text);
+        try {
+            benchmark::BenchSuite::ReadJson(path);
+        } catch(std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+
+    benchmark::BenchSuite suite;
+    suite.max_samples = 10;
+    suite.max_op_samples = 50;
+    std::string long_name(5000, 'x');
+    const char *names[] = { "plain", "quote\"back\\slash\ttab", long_name.c_str() };
+    volatile int sink = 0;
+    for(const char *name : names) {
+        suite.Run(name, [&](int n) {
+            for(int i = 0; i < n; i++) {
+                sink = sink + i;
+            }
+        }, 1000);
+    }
+    suite.WriteJson(path);
+
+    std::vector<benchmark::BenchResult> read = benchmark::BenchSuite::ReadJson(path);
+    if(read.size() != suite.Results().size()) {
+        remove(path);
+        throw std::runtime_error("Bench JSON: Wrong number of results");
+    }
+    for(size_t i = 0; i < read.size(); i++) {
+        const benchmark::BenchResult& r = suite.Results()[i];
+        if(read[i].name != r.name || read[i].iterations != r.iterations
+            || std::isnan(read[i].p99_ns) || std::fabs(read[i].median_ns - r.median_ns) > 0.001) {
+            remove(path);
+            throw std::runtime_error("Bench JSON: Result did not round-trip");
+        }
+    }
+
+    bool all_rejected = rejected("{\"benchmarks\":[\n{\"name\":\"a\",\"median_ns\":1.0}\n")
+        && rejected("{\"benchmarks\":[{\"name\":\"a\"}]}")
+        && rejected("{\"benchmarks\":[{\"median_ns\":1.0}]}")
+        && rejected("{\"benchmarks\":[{\"name\":\"a\",\"median_ns\":fast}]}")
+        && rejected("{\"benchmarks\":[]} trailing")
+        && rejected("");
+    remove(path);
+    if(!all_rejected) {
+        throw std::runtime_error("Bench JSON: Malformed baseline accepted");
+    }
+}
+
+// Usage: ort_test [--compare <baseline.json>] [--threshold <fraction>]
+//
+// Results are written to bench_output.txt. With --compare, benchmarks whose
+// median is more than `threshold` (default 0.1) slower than in the baseline
+// are reported and the exit status is 1.
+int main(int argc, char **argv) {
+    const char *baseline_path = nullptr;
+    double threshold = 0.1;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--compare <baseline.json>] [--threshold <fraction>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bench_suite.alloc_counter = alloc_count::TotalAllocs;
+
+    test_call();
+    test_invoke_args();
+    test_invoke_batch();
+    test_native_typed();
+    test_field_table();
+    test_field_dispatch();
+    test_field_miss();
+    test_string_read();
+    test_string_intern();
+    test_static_slot();
+    test_value_decode();
+    test_sum();
+    test_proxied();
+    test_object_handle();
+    test_borrowed_handle_release();
+    test_proxied_downcast();
+    test_writer_no_copy();
+    test_writer_owned_strings();
+    test_serialize();
+    test_json_golden();
+    test_callback_sink();
+    test_bench_json();
+    test_encoding();
+    test_writer_memory();
+    test_writer_arena();
+    test_runtime_pool();
+    test_invoke_async();
+    test_function_stats();
+    test_profiler();
+    test_ffi_trace();
+
+    bench_suite.WriteJson("bench_output.txt");
+
+    if(baseline_path) {
+        std::vector<benchmark::BenchResult> baseline = benchmark::BenchSuite::ReadJson(baseline_path);
+        if(bench_suite.Compare(baseline, threshold) > 0) {
+            return 1;
+        }
+    }
 
     return 0;
 }
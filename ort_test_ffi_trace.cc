@@ -0,0 +1,4 @@
+// ort_test built with FFI tracing enabled, so the checks in test_ffi_trace
+// that are compiled out by default run. Build and run it like ort_test.cc.
+#define HX_ORT_TRACE_FFI
+#include "ort_test.cc"
@@ -0,0 +1,6 @@
+// ort_test built without RTTI, to check that ort.h and the tests do not
+// depend on it. Build with -fno-rtti and run it like ort_test.cc.
+#if defined(__cpp_rtti) || defined(__GXX_RTTI)
+#error "ort_test_nortti.cc must be built with -fno-rtti"
+#endif
+#include "ort_test.cc"
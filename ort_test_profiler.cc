@@ -0,0 +1,5 @@
+// ort_test built with the sampling profiler enabled, so the checks in
+// test_profiler that are compiled out by default run. Build and run it
+// like ort_test.cc.
+#define HX_ORT_ENABLE_PROFILER
+#include "ort_test.cc"
@@ -0,0 +1,5 @@
+// ort_test built with call statistics enabled, so the checks in
+// test_function_stats that are compiled out by default run. Build and run
+// it like ort_test.cc.
+#define HX_ORT_ENABLE_STATS
+#include "ort_test.cc"